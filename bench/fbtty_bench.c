@@ -0,0 +1,259 @@
+/* fbtty_bench - Timing of conversion and blit kernels
+ *
+ * Build and run with `make bench`. Every case draws a synthetic image into
+ * a virtual framebuffer kept in memfd, so no /dev/fb0 is needed, and is
+ * repeated until its time budget is used up. One JSON object per case is
+ * printed to stdout, with throughput (from median call) and per-call
+ * latency percentiles, so results of two builds can be compared by script.
+ *
+ * Usage: fbtty_bench [-t <seconds per case>] [-s <max pixels>] [<kernel>...]
+ * Kernels: write_image, draw_placement (banded pipeline, turned or not).
+ */
+
+#define FBTTY_NO_MAIN
+#include "../fbtty.c"
+#include <time.h>
+
+#define BENCH_MAX_CALLS 10000
+#define BENCH_MIN_CALLS 3
+
+static const int bench_sizes[][2] = {
+    {32, 32}, {256, 256}, {1920, 1080}, {3840, 2160}, {7680, 4320}
+};
+
+static const char* bench_formats[] = {"xrgb8888", "rgb565", "rgb888", "pal8"};
+
+static const char* dither_names[] = {"ordered", "fs", "none"};
+
+typedef struct {
+    const char* kernel;
+    int width, height, channels;
+    const char* format;
+    dither_mode dither;
+    int orientation;
+} bench_case;
+
+typedef struct {
+    unsigned char* data;        // RGB or premultiplied BGRA image
+    fb_virtual virt;
+    term_info info;
+    fb_palette* palette;
+    int fbfd;
+    char* fb_ptr;
+} bench_target;
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, int count, double q) {
+    return sorted[(int) (q * (count - 1) + 0.5)];
+}
+
+/**
+ * Make image with smooth gradients and some noise, so dithering and palette
+ * lookups see realistic colors. Images with alpha get opaque, transparent
+ * and translucent areas, and are premultiplied as fbtty does.
+ */
+static unsigned char* make_image(int width, int height, int channels) {
+    unsigned char* data = malloc((size_t) width * height * channels);
+    if (data == NULL)
+        return NULL;
+    unsigned int seed = 12345;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            unsigned char* pixel = data + ((size_t) y * width + x) * channels;
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) & 15;
+            pixel[0] = (x * 255 / width + noise) & 0xFF;
+            pixel[1] = (y * 255 / height + noise) & 0xFF;
+            pixel[2] = ((x + y) * 127 / (width + height) + noise) & 0xFF;
+            if (channels == 4) {
+                int band = (x / 64 + y / 64) % 3;
+                pixel[3] = band == 0 ? 255 : band == 1 ? 0 : (x * 7 + y) & 0xFF;
+            }
+        }
+    if (channels == 4)
+        premultiply_rgba(data, width * 4, width, height);
+    return data;
+}
+
+static int open_target(bench_target* target, int width, int height, int channels, const char* format) {
+    memset(target, 0, sizeof(*target));
+    target->fbfd = -1;
+    target->fb_ptr = MAP_FAILED;
+
+    char spec[64];
+    snprintf(spec, sizeof(spec), "%dx%d:%s", width, height, format);
+    if (fb_virtual_parse(spec, &target->virt) == -1)
+        return -1;
+    target->fbfd = fb_virtual_open(NULL, &target->virt);
+    if (target->fbfd == -1)
+        return -1;
+
+    // terminal isn't queried, image is drawn at left-top corner of screen
+    const struct fb_var_screeninfo* vinfo = &target->virt.vinfo;
+    term_info* info = &target->info;
+    info->line_length = target->virt.finfo.line_length;
+    info->screen_size = (long) info->line_length * height;
+    info->cell_size[0] = 8;
+    info->cell_size[1] = 16;
+    info->terminal_size[0] = width / 8 + 1;
+    info->terminal_size[1] = height / 16 + 1;
+    info->visual = target->virt.finfo.visual;
+    info->resolution[0] = width;
+    info->resolution[1] = height;
+    info->rotation = FB_ROTATE_UR;
+    info->format.bytes_per_pixel = vinfo->bits_per_pixel / 8;
+    info->format.offset[0] = vinfo->red.offset;
+    info->format.offset[1] = vinfo->green.offset;
+    info->format.offset[2] = vinfo->blue.offset;
+    info->format.length[0] = vinfo->red.length;
+    info->format.length[1] = vinfo->green.length;
+    info->format.length[2] = vinfo->blue.length;
+    if (info->visual == FB_VISUAL_PSEUDOCOLOR) {
+        target->palette = init_palette(target->fbfd, &target->virt, info, 0);
+        if (target->palette == NULL)
+            return -1;
+    }
+    target->fb_ptr = mmap(0, info->screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, target->fbfd, 0);
+    if (target->fb_ptr == MAP_FAILED)
+        return -1;
+    target->data = make_image(width, height, channels);
+    return target->data != NULL ? 0 : -1;
+}
+
+static void close_target(bench_target* target) {
+    if (target->fb_ptr != MAP_FAILED)
+        munmap(target->fb_ptr, target->info.screen_size);
+    if (target->fbfd != -1)
+        close(target->fbfd);
+    free(target->palette);
+    free(target->data);
+}
+
+static void run_once(const bench_case* c, bench_target* target) {
+    term_info* info = &target->info;
+    info->dither = c->dither;
+    if (strcmp(c->kernel, "write_image") == 0) {
+        write_image((int[]){0, 0}, c->width, c->height, c->width * 3, info->line_length,
+                    target->data, target->fb_ptr, &info->format, c->dither);
+        return;
+    }
+    // turned image is stored the other way around, so it covers screen as shown
+    int sideways = fb_rotate_is_sideways(c->orientation);
+    int data_size[2] = {sideways ? c->height : c->width, sideways ? c->width : c->height};
+    placement place = {
+        .data = target->data, .data_size = {data_size[0], data_size[1]}, .orientation = c->orientation,
+        .width = c->width, .height = c->height, .channels = c->channels,
+        .line_length = data_size[0] * c->channels, .background = -1,
+        .visible_size = {c->width, c->height}
+    };
+    draw_placement(info, &place, target->fb_ptr);
+}
+
+/**
+ * Time *c* until *budget* seconds are used and print its results.
+ */
+static void run_case(const bench_case* c, bench_target* target, double budget, double* samples) {
+    run_once(c, target);    // fault pages in, warm caches
+    int calls = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (calls < BENCH_MAX_CALLS && (calls < BENCH_MIN_CALLS || seconds_since(&start) < budget)) {
+        struct timespec call_start;
+        clock_gettime(CLOCK_MONOTONIC, &call_start);
+        run_once(c, target);
+        samples[calls++] = seconds_since(&call_start);
+    }
+    qsort(samples, calls, sizeof(double), compare_double);
+
+    double median = percentile(samples, calls, 0.5);
+    double pixels = (double) c->width * c->height;
+    double bytes = pixels * target->info.format.bytes_per_pixel;
+    printf("{\"kernel\": \"%s\", \"width\": %d, \"height\": %d, \"channels\": %d, \"format\": \"%s\", "
+           "\"dither\": \"%s\", \"orientation\": %d, \"calls\": %d, \"mpix_per_s\": %.2f, \"mb_per_s\": %.2f, "
+           "\"min_us\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f}\n",
+           c->kernel, c->width, c->height, c->channels, c->format, dither_names[c->dither], c->orientation,
+           calls, pixels / median * 1e-6, bytes / median * 1e-6, samples[0] * 1e6, median * 1e6,
+           percentile(samples, calls, 0.9) * 1e6, percentile(samples, calls, 0.99) * 1e6);
+    fflush(stdout);
+}
+
+static int kernel_selected(const char* kernel, char** names, int count) {
+    if (count == 0)
+        return 1;
+    for (int i = 0; i < count; i++)
+        if (strcmp(names[i], kernel) == 0)
+            return 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    double budget = 0.2;
+    long max_pixels = 7680L * 4320;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+        switch (opt) {
+            case 't':
+                budget = atof(optarg);
+                break;
+            case 's':
+                max_pixels = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: fbtty_bench [-t <seconds per case>] [-s <max pixels>] [<kernel>...]\n");
+                return 1;
+        }
+    }
+    char** kernels = argv + optind;
+    int kernel_count = argc - optind;
+
+    double* samples = malloc(sizeof(double) * BENCH_MAX_CALLS);
+    if (samples == NULL)
+        return 1;
+    int failed = 0;
+    for (size_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+        int width = bench_sizes[s][0], height = bench_sizes[s][1];
+        if ((long) width * height > max_pixels)
+            continue;
+        for (size_t f = 0; f < sizeof(bench_formats) / sizeof(bench_formats[0]); f++) {
+            const char* format = bench_formats[f];
+            int xrgb = strcmp(format, "xrgb8888") == 0;
+            // blending is done on xrgb8888 only, other formats get flattened image
+            for (int channels = 3; channels <= (xrgb ? 4 : 3); channels++) {
+                bench_target target;
+                if (open_target(&target, width, height, channels, format) == -1) {
+                    fprintf(stderr, "Error: couldn't set up %dx%d %s target\n", width, height, format);
+                    close_target(&target);
+                    failed = 1;
+                    continue;
+                }
+                for (int d = DITHER_ORDERED; d <= DITHER_NONE; d++) {
+                    // xrgb8888 has nothing to dither
+                    if (xrgb && d != DITHER_ORDERED)
+                        continue;
+                    bench_case c = {"write_image", width, height, channels, format, d, FB_ROTATE_UR};
+                    if (channels == 3 && kernel_selected(c.kernel, kernels, kernel_count))
+                        run_case(&c, &target, budget, samples);
+                    c.kernel = "draw_placement";
+                    if (!kernel_selected(c.kernel, kernels, kernel_count))
+                        continue;
+                    run_case(&c, &target, budget, samples);
+                    c.orientation = FB_ROTATE_CW;
+                    run_case(&c, &target, budget, samples);
+                }
+                close_target(&target);
+            }
+        }
+    }
+    free(samples);
+    return failed;
+}
@@ -0,0 +1,289 @@
+/* fbtty_latency - End-to-end time of fbtty under a pseudo-terminal
+ *
+ * Build and run with `make bench-latency` (uses banner.png), or
+ *   fbtty_latency [options] <img_path>...
+ *
+ * fbtty is started on a pty, drawing into virtual framebuffer, and time
+ * from exec to its exit is measured. The harness plays the terminal: it
+ * answers cursor position (CSI 6 n) and cell size (CSI 16 t) queries after
+ * configurable delays. Pty has no pixel size, so cell size is asked for
+ * like in terminals which don't report it. In tmux modes a stub `tmux` put
+ * first on PATH answers pane offset queries after its own delay, so cost
+ * of get_cursor_pos, get_tty_offset and set_cursor_pos can be seen without
+ * real terminal or tmux. One JSON object per mode and image is printed.
+ *
+ * Options:
+ *   -x <path>   fbtty binary (./fbtty by default)
+ *   -r <runs>   timed runs per mode and image (20 by default)
+ *   -d <ms>     delay of reply to CSI 6 n (1 by default)
+ *   -c <ms>     delay of reply to CSI 16 t (1 by default)
+ *   -m <ms>     delay of stub tmux (5 by default)
+ *   -g <WxH[:fmt]> virtual framebuffer (1920x1080 by default)
+ * Persistent modes (-F, -k) wait for a key and aren't timed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pty.h>        // forkpty
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LATENCY_MAX_RUNS 1000
+
+typedef struct {
+    const char* name;
+    const char* args[3];    // extra fbtty arguments, NULL terminated
+    int tmux;               // run in (stub) tmux
+    int cached;             // run once untimed first, so tty cache is warm
+} latency_mode;
+
+static const latency_mode latency_modes[] = {
+    {"bottom",       {"-n", "-b", NULL}, 0, 0},
+    {"flow",         {"-n", "-f", NULL}, 0, 0},
+    {"top",          {"-n", "-t", NULL}, 0, 0},
+    {"cached",       {"-b", NULL},       0, 1},
+    {"tmux",         {"-n", "-b", NULL}, 1, 0},
+    {"tmux-cached",  {"-b", NULL},       1, 1},
+};
+
+typedef struct {
+    const char* fbtty;
+    const char* virtual_fb;
+    int dsr_delay_ms;
+    int cell_delay_ms;
+    int tmux_delay_ms;
+} harness;
+
+typedef struct {
+    int cursor_queries;     // CSI 6 n
+    int cell_queries;       // CSI 16 t
+} query_counts;
+
+// Stub of tmux: pane offset for `tmux display`, minimal control mode for `tmux -C`
+static const char tmux_stub[] =
+    "#!/bin/sh\n"
+    "sleep \"$FBTTY_STUB_DELAY\"\n"
+    "case \"$1\" in\n"
+    "    display) echo \"0 0\" ;;\n"
+    "    -C)\n"
+    "        echo '%begin 0 1 0'; echo '%end 0 1 0'\n"
+    "        while read -r line; do\n"
+    "            echo '%begin 0 2 0'; echo '0 0 80 24 1 0 1'; echo '%end 0 2 0'\n"
+    "        done\n"
+    "        echo '%exit' ;;\n"
+    "esac\n";
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec delay = {ms / 1000, (ms % 1000) * 1000000L};
+    while (nanosleep(&delay, &delay) == -1 && errno == EINTR);
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, int count, double q) {
+    return sorted[(int) (q * (count - 1) + 0.5)];
+}
+
+/**
+ * Put stub tmux into new directory *dir* and put that first on PATH.
+ * Runtime directory (tty cache) is moved there too, so user's cache is
+ * left alone. Returns 0 on success.
+ */
+static int setup_environment(char* dir, int tmux_delay_ms) {
+    if (mkdtemp(dir) == NULL)
+        return -1;
+    char path[300];
+    snprintf(path, sizeof(path), "%s/tmux", dir);
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+    fputs(tmux_stub, file);
+    fclose(file);
+    if (chmod(path, 0755) == -1)
+        return -1;
+
+    char delay[32];
+    snprintf(delay, sizeof(delay), "%d.%03d", tmux_delay_ms / 1000, tmux_delay_ms % 1000);
+    const char* old_path = getenv("PATH");
+    char new_path[4096];
+    snprintf(new_path, sizeof(new_path), "%s:%s", dir, old_path != NULL ? old_path : "/usr/bin:/bin");
+    setenv("PATH", new_path, 1);
+    setenv("FBTTY_STUB_DELAY", delay, 1);
+    setenv("XDG_RUNTIME_DIR", dir, 1);
+    if (getenv("TERM") == NULL)
+        setenv("TERM", "xterm", 1);
+    return 0;
+}
+
+static void remove_environment(const char* dir) {
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    system(command);
+}
+
+/**
+ * Answer terminal queries found in *data*. *tail* keeps end of previous
+ * chunk, so query split between two reads is still found.
+ */
+static void answer_queries(int master, const harness* h, const char* data, int len,
+                           char* tail, query_counts* counts) {
+    char buf[4096 + 8];
+    int tail_len = strlen(tail);
+    memcpy(buf, tail, tail_len);
+    memcpy(buf + tail_len, data, len);
+    int buf_len = tail_len + len;
+    buf[buf_len] = '\0';
+
+    int answered = 0;   // end of last answered query
+    for (int i = 0; i < buf_len; i++) {
+        if (buf[i] != '\033')
+            continue;
+        if (strncmp(buf + i, "\033[6n", 4) == 0) {
+            sleep_ms(h->dsr_delay_ms);
+            write(master, "\033[1;1R", 6);
+            counts->cursor_queries++;
+            answered = i + 4;
+        } else if (strncmp(buf + i, "\033[16t", 5) == 0) {
+            sleep_ms(h->cell_delay_ms);
+            write(master, "\033[6;16;8t", 9);
+            counts->cell_queries++;
+            answered = i + 5;
+        }
+    }
+    // last bytes may be start of query
+    int from = buf_len - 4 > answered ? buf_len - 4 : answered;
+    const char* escape = memchr(buf + from, '\033', buf_len - from);
+    if (escape != NULL)
+        snprintf(tail, 8, "%s", escape);
+    else
+        tail[0] = '\0';
+}
+
+/**
+ * Run fbtty once in *mode* on *image*. Sets *elapsed* seconds from exec
+ * to exit. Returns exit status of fbtty or -1 if it couldn't be run.
+ */
+static int run_fbtty(const harness* h, const latency_mode* mode, const char* image,
+                     double* elapsed, query_counts* counts) {
+    char virtual_fb[64];
+    snprintf(virtual_fb, sizeof(virtual_fb), "--virtual-fb=%s", h->virtual_fb);
+    const char* argv[8];
+    int argc = 0;
+    argv[argc++] = h->fbtty;
+    argv[argc++] = virtual_fb;
+    for (int i = 0; mode->args[i] != NULL; i++)
+        argv[argc++] = mode->args[i];
+    argv[argc++] = image;
+    argv[argc] = NULL;
+
+    struct winsize winsize = {24, 80, 0, 0};
+    int master;
+    double start = now_seconds();
+    pid_t pid = forkpty(&master, NULL, NULL, &winsize);
+    if (pid == -1)
+        return -1;
+    if (pid == 0) {
+        if (mode->tmux) {
+            setenv("TMUX", "/tmp/fbtty-stub,1,0", 1);
+            setenv("TMUX_PANE", "%0", 1);
+        } else {
+            unsetenv("TMUX");
+            unsetenv("TMUX_PANE");
+        }
+        execv(h->fbtty, (char**) argv);
+        _exit(127);
+    }
+
+    memset(counts, 0, sizeof(*counts));
+    char tail[8] = "";
+    char data[4096];
+    while (1) {
+        int got = read(master, data, sizeof(data));
+        if (got > 0)
+            answer_queries(master, h, data, got, tail, counts);
+        else if (got == -1 && errno == EINTR)
+            continue;
+        else
+            break;  // EIO when fbtty and its children closed pty
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    *elapsed = now_seconds() - start;
+    close(master);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char* argv[]) {
+    harness h = {"./fbtty", "1920x1080", 1, 1, 5};
+    int runs = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "x:r:d:c:m:g:")) != -1) {
+        switch (opt) {
+            case 'x': h.fbtty = optarg; break;
+            case 'r': runs = atoi(optarg); break;
+            case 'd': h.dsr_delay_ms = atoi(optarg); break;
+            case 'c': h.cell_delay_ms = atoi(optarg); break;
+            case 'm': h.tmux_delay_ms = atoi(optarg); break;
+            case 'g': h.virtual_fb = optarg; break;
+            default:
+                fprintf(stderr, "Usage: fbtty_latency [-x <fbtty>] [-r <runs>] [-d <ms>] [-c <ms>] [-m <ms>] "
+                                "[-g <WxH[:fmt]>] <img_path>...\n");
+                return 1;
+        }
+    }
+    if (optind >= argc || runs < 1 || runs > LATENCY_MAX_RUNS) {
+        fprintf(stderr, "Error: no images given or runs out of 1..%d\n", LATENCY_MAX_RUNS);
+        return 1;
+    }
+
+    char dir[] = "/tmp/fbtty-latency-XXXXXX";
+    if (setup_environment(dir, h.tmux_delay_ms) == -1) {
+        fprintf(stderr, "Error: couldn't set up stub tmux in %s\n", dir);
+        return 1;
+    }
+
+    double samples[LATENCY_MAX_RUNS];
+    int failed = 0;
+    for (int i = optind; i < argc; i++)
+        for (size_t m = 0; m < sizeof(latency_modes) / sizeof(latency_modes[0]); m++) {
+            const latency_mode* mode = &latency_modes[m];
+            query_counts counts;
+            double elapsed;
+            if (mode->cached)
+                run_fbtty(&h, mode, argv[i], &elapsed, &counts);
+            int status = 0, total_queries[2] = {0, 0};
+            for (int r = 0; r < runs && status == 0; r++) {
+                status = run_fbtty(&h, mode, argv[i], &samples[r], &counts);
+                total_queries[0] += counts.cursor_queries;
+                total_queries[1] += counts.cell_queries;
+            }
+            if (status != 0) {
+                fprintf(stderr, "Error: fbtty failed (status %d) in mode %s on %s\n", status, mode->name, argv[i]);
+                failed = 1;
+                continue;
+            }
+            qsort(samples, runs, sizeof(double), compare_double);
+            printf("{\"mode\": \"%s\", \"image\": \"%s\", \"runs\": %d, \"cursor_queries\": %.1f, "
+                   "\"cell_queries\": %.1f, \"min_ms\": %.2f, \"p50_ms\": %.2f, \"p90_ms\": %.2f, \"max_ms\": %.2f}\n",
+                   mode->name, argv[i], runs, (double) total_queries[0] / runs, (double) total_queries[1] / runs,
+                   samples[0] * 1e3, percentile(samples, runs, 0.5) * 1e3,
+                   percentile(samples, runs, 0.9) * 1e3, samples[runs-1] * 1e3);
+            fflush(stdout);
+        }
+
+    remove_environment(dir);
+    return failed;
+}
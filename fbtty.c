@@ -1,23 +1,121 @@
+#define FB_ARENA_IMPLEMENTATION
+#include "libs/fb_arena.h"
+// decoder takes memory from arena, so it's reused across images
+#define STBI_MALLOC(size) fb_arena_alloc(size)
+#define STBI_REALLOC(ptr, size) fb_arena_realloc(ptr, size)
+#define STBI_FREE(ptr) fb_arena_free(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "libs/stb_image.h" // includes <stdio.h>
 #define TERMINAL_OPER_IMPLEMENTATION
 #include "libs/terminal_oper.h"
+#define TTY_CACHE_IMPLEMENTATION
+#include "libs/tty_cache.h"
+#define TMUX_CONTROL_IMPLEMENTATION
+#include "libs/tmux_control.h"
+#define FB_BLIT_IMPLEMENTATION
+#include "libs/fb_blit.h"
+#define FB_PALETTE_IMPLEMENTATION
+#include "libs/fb_palette.h"
+#define SAVE_UNDER_IMPLEMENTATION
+#include "libs/save_under.h"
+#define SHADOW_FB_IMPLEMENTATION
+#include "libs/shadow_fb.h"
+#define FB_PAGE_IMPLEMENTATION
+#include "libs/fb_page.h"
+#define FB_DITHER_IMPLEMENTATION
+#include "libs/fb_dither.h"
+#define FB_ROTATE_IMPLEMENTATION
+#include "libs/fb_rotate.h"
+#define EXIF_ORIENT_IMPLEMENTATION
+#include "libs/exif_orient.h"
+#define FB_VIRTUAL_IMPLEMENTATION
+#include "libs/fb_virtual.h"
+#define FB_DUMP_IMPLEMENTATION
+#include "libs/fb_dump.h"
+#define FB_RAW_IMPLEMENTATION
+#include "libs/fb_raw.h"
+#define QOI_IMPLEMENTATION
+#include "libs/qoi.h"
+#define FB_STATS_IMPLEMENTATION
+#include "libs/fb_stats.h"
+#define BLIT_TUNE_IMPLEMENTATION
+#include "libs/blit_tune.h"
 #include <fcntl.h> // open
 #include <getopt.h>
 #include <sys/ioctl.h> // ioctl
 #include <linux/fb.h> // ioctl requests
 #include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <limits.h> // INT_MAX
+#include <stdint.h> // SIZE_MAX
 #include <errno.h>
+#include <signal.h> // sigaction
+#include <pthread.h>
 
 
 const char usage_note[] = 
-    "Usage: fbtty [options] [-o <out_path>] <img_path>\n"
-    "Write image from <img_path> to /dev/fb0 or other path if <out_path> provided.\n"
+    "Usage: fbtty [options] [-o <out_path>] <img_path>...\n"
+    "Write images from <img_path>s one after another to /dev/fb0 or other path if\n"
+    "<out_path> provided.\n"
     "\n"
     "Options:\n"
     "  -h --help                          Print this note.\n"
+    "  -F --follow                        Stay running and redraw image when terminal is resized\n"
+    "                                     or tmux pane is moved, resized or shown again.\n"
+    "                                     Quit with q or Ctrl-C.\n"
+    "  -k --keep[=<ms>]                   Stay running and redraw parts of image overwritten\n"
+    "                                     by text, checking every <ms> milliseconds (250 by default).\n"
+    "                                     Quit with q or Ctrl-C.\n"
+    "  -B <color> --background=<color>    Blend transparent parts of image over <color> (RRGGBB)\n"
+    "                                     instead of screen content.\n"
+    "  -V --vsync                         With -F or -k redraw without tearing: flip pages if\n"
+    "                                     console is in graphics mode and framebuffer has room\n"
+    "                                     for two, else wait for vertical blank.\n"
+    "  -C <x,y,w,h> --crop=<x,y,w,h>      Show only <w> x <h> pixels of image from its pixel <x>,<y>.\n"
+    "  -S <cols,lines> --scroll=<cols,lines>\n"
+    "                                     Move shown part of image by <cols> columns and <lines>\n"
+    "                                     lines of pane.\n"
+    "  -d <mode> --dither=<mode>          Dithering on framebuffers with less than 8 bits per color:\n"
+    "                                     ordered (default), fs (Floyd-Steinberg, slower but\n"
+    "                                     smoother, uses all CPUs) or none. On 8bpp palette\n"
+    "                                     framebuffers only fs dithers.\n"
+    "  -P --set-palette                   On 8bpp palette framebuffer install color cube above\n"
+    "                                     16 console colors instead of using current palette.\n"
+    "                                     Previous palette is put back at exit.\n"
+    "  -n --no-cache                      Don't use cached terminal geometry, query it again.\n"
+    "  -s <id> --save-under=<id>          Save screen region covered by image under <id>.\n"
+    "  -c <id> --clear=<id>               Remove image by restoring region saved under <id>.\n"
     "  -o <out_path> --output=<out_path>  Write bytes of image to device with <out_path> path.\n"
     "                                     Defaults to /dev/fb0\n"
+    "  -X <WxH[:fmt]> --virtual-fb=<WxH[:fmt]>\n"
+    "                                     Draw into virtual framebuffer of <W> x <H> pixels of\n"
+    "                                     format <fmt>: xrgb8888 (default), xbgr8888, rgb888,\n"
+    "                                     rgb565, xrgb1555 or pal8. It's kept in <out_path> file\n"
+    "                                     if -o is given, else in memory. For tests and benchmarks.\n"
+    "  -D <path> --dump=<path>            Save framebuffer as PPM (or PNG if <path> ends with .png)\n"
+    "                                     after drawing.\n"
+    "  -T --stats[=hw]                    Print time spent in each stage, bytes moved and peak\n"
+    "                                     memory use to stderr at exit. With hw also CPU cycles,\n"
+    "                                     IPC, bytes per cycle, cache and TLB misses of stages.\n"
+    "  -R <file> --trace=<file>           Write stages as Chrome trace (JSON) for Perfetto.\n"
+    "  -A --calibrate                     Time ways of writing pixels (streaming, plain or\n"
+    "                                     memcpy stores, pwrite) and thread counts on output\n"
+    "                                     device, covering whole screen for a moment, and save\n"
+    "                                     the fastest for this device and resolution. Later\n"
+    "                                     runs use it.\n"
+    "  -E <kind> --convert=<kind>         Save image to <out_path> in form which is fast to draw\n"
+    "                                     instead of showing it. <kind> is raw: pixels in format\n"
+    "                                     of /dev/fb0, or of -X framebuffer if given (raw image\n"
+    "                                     is shown only on framebuffer of that format, copied\n"
+    "                                     straight from file), or qoi: lossless QOI, decoded\n"
+    "                                     much faster than PNG.\n"
+    "  -H --huge-pages                    Back decoder memory with transparent huge pages.\n"
+    "  -M <size> --max-mem=<size>         Skip images whose decoding would take more than <size>\n"
+    "                                     bytes (K, M or G suffix allowed), judged from their\n"
+    "                                     header, and never let decoder allocate more. Such\n"
+    "                                     images fail with error, they aren't decoded in parts\n"
+    "                                     or scaled down. Raw images copied straight from file\n"
+    "                                     (see --convert) need no decoder memory.\n"
     "  -v --version                       Print program version.\n"
     "\n"
     "Cursor options:\n"
@@ -35,9 +133,7 @@ void get_cursor_mpos(const int* margin, int* position) {
 }
 
 // Set position_px to position adjusted by tty offset
-void get_cursor_pos_px(const int* cursor_pos, const int* cell_size, int* position_px) {
-    int offset[2];
-    get_tty_offset(offset);
+void get_cursor_pos_px(const int* cursor_pos, const int* offset, const int* cell_size, int* position_px) {
     position_px[0] = (cursor_pos[0]+offset[0])*cell_size[0];
     position_px[1] = (cursor_pos[1]+offset[1])*cell_size[1];
 }
@@ -48,7 +144,32 @@ void get_cursor_pos_px(const int* cursor_pos, const int* cell_size, int* positio
 #define BLE(pixel) *(pixel+2)
 #define ALPHA(pixel) *(pixel+3)
 
-void write_image(int* offset, int width, int height, int img_line_length, int fb_line_length, unsigned char* data, char* fb_ptr) {
+typedef enum {
+    DITHER_ORDERED, // Bayer matrix aligned to screen, redrawn parts match
+    DITHER_FS,      // Floyd-Steinberg error diffusion
+    DITHER_NONE
+} dither_mode;
+
+/**
+ * Convert RGB image into pixels of *format* with *dither* mode.
+ * *offset* is position of *out* on screen.
+ */
+void convert_image(const unsigned char* data, int img_line_length, int width, int height,
+                   unsigned char* out, int out_line_length, const fb_format* format, dither_mode dither, const int* offset) {
+    if (dither == DITHER_FS && !is_xrgb8888(format)
+            && fs_dither_rows(data, img_line_length, width, height, out, out_line_length, format->bytes_per_pixel,
+                              format->palette_lut != NULL ? fs_quantize_palette : fs_quantize_truecolor, format, 0) == 0)
+        return;
+    convert_rgb_rows(data, img_line_length, width, height, out, out_line_length, format,
+                     dither == DITHER_NONE ? NULL : offset);
+}
+
+void write_image(int* offset, int width, int height, int img_line_length, int fb_line_length, unsigned char* data, char* fb_ptr, const fb_format* format, dither_mode dither) {
+    if (!is_xrgb8888(format)) {
+        char* fb_loc = fb_ptr + offset[0] * format->bytes_per_pixel + offset[1] * fb_line_length;
+        convert_image(data, img_line_length, width, height, (unsigned char*) fb_loc, fb_line_length, format, dither, offset);
+        return;
+    }
     for (int y=0; y < height; y++) {
         for (int x=0; x < width; x++) {
             int fb_loc = (x + offset[0]) * 4 + (y + offset[1]) * fb_line_length;
@@ -62,6 +183,433 @@ void write_image(int* offset, int width, int height, int img_line_length, int fb
 }
 
 
+// stages of drawing, measured with --stats or --trace
+static fb_stats stats;
+
+typedef struct {
+    int line_length;        // length of line in bytes 
+    long screen_size;       // line_length * yres bytes, used in mmap
+    int terminal_size[2];   // size of terminal (or pane) in columns and lines
+    int cell_size[2];       // size of character cell in pixels
+    int tty_offset[2];      // left-top offset of terminal (pane) in columns and lines
+    int ypanstep;           // framebuffer can flip pages if > 0 and there is room
+    int can_vsync;          // framebuffer can wait for vertical blank
+    int visual;             // FB_VISUAL_* of framebuffer
+    int resolution[2];      // visible size of framebuffer in pixels
+    int rotation;           // rotation of console (FB_ROTATE_*), cells are turned by it
+    fb_format format;       // pixel format of framebuffer, palette is set up by caller
+    dither_mode dither;     // how to convert to formats with fewer bits
+    int fbfd;               // framebuffer device, written to by BLIT_PWRITE
+    blit_choice blit;       // how to write pixels, saved by --calibrate
+} term_info;
+
+/**
+ * Get screen info of framebuffer *fbfd* from driver, or of *virt* if it's
+ * not NULL. Returns -1 if *fbfd* isn't a framebuffer.
+ */
+int get_screen_info(int fbfd, const fb_virtual* virt,
+                    struct fb_var_screeninfo* vinfo, struct fb_fix_screeninfo* finfo) {
+    if (virt != NULL) {
+        *vinfo = virt->vinfo;
+        *finfo = virt->finfo;
+        return 0;
+    }
+    if (ioctl(fbfd, FBIOGET_VSCREENINFO, vinfo) == -1 || ioctl(fbfd, FBIOGET_FSCREENINFO, finfo) == -1)
+        return -1;
+    return 0;
+}
+
+/**
+ * Get pixel format from screen info, palette is set up separately.
+ * Returns -1 for formats which can't be drawn: channels over 8 bits or
+ * not fitting in pixel.
+ */
+int get_pixel_format(const struct fb_var_screeninfo* vinfo, fb_format* format) {
+    format->bytes_per_pixel = vinfo->bits_per_pixel / 8;
+    format->offset[0] = vinfo->red.offset;
+    format->offset[1] = vinfo->green.offset;
+    format->offset[2] = vinfo->blue.offset;
+    format->length[0] = vinfo->red.length;
+    format->length[1] = vinfo->green.length;
+    format->length[2] = vinfo->blue.length;
+    format->palette = NULL;
+    format->palette_lut = NULL;
+    if (vinfo->bits_per_pixel % 8 != 0 || format->bytes_per_pixel < 1 || format->bytes_per_pixel > 4)
+        return -1;
+    for (int c = 0; c < 3; c++)
+        if (format->length[c] > 8 || format->offset[c] + format->length[c] > (int) vinfo->bits_per_pixel)
+            return -1;
+    return 0;
+}
+
+/**
+ * Assign information about terminal.
+ * *fbfd* - file descriptor of framebuffer device, *virt* - its geometry
+ * when it's virtual (NULL otherwise).
+ * Without terminal (output redirected) the whole screen is taken as one.
+ * Facts which are slow to find out (cell size, vsync support, offset outside
+ * tmux) are read from per-tty cache when *use_cache* is set and cache key
+ * still matches.
+ * Vsync support is probed only with *want_vsync*, waiting for it can take a frame.
+ * Returns -1 when *fbfd* isn't framebuffer, -2 when its pixel format isn't supported.
+ */
+int init_term_info(int fbfd, const fb_virtual* virt, const char* out_path, int use_cache, int want_vsync,
+                   term_info *info) {
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+    if (get_screen_info(fbfd, virt, &vinfo, &finfo) == -1)
+        return -1;
+
+    struct winsize winfo;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &winfo) == -1)
+        memset(&winfo, 0, sizeof(winfo));
+
+    // lines can be padded, drawing goes at line_length stride
+    info->screen_size = (long) finfo.line_length * vinfo.yres;
+    info->resolution[0] = vinfo.xres;
+    info->resolution[1] = vinfo.yres;
+    // console rotation belongs to real display only
+    info->rotation = virt == NULL ? fb_rotate_read_console() : FB_ROTATE_UR;
+    info->terminal_size[0] = winfo.ws_col;
+    info->terminal_size[1] = winfo.ws_row;
+    if (get_pixel_format(&vinfo, &info->format) == -1)
+        return -2;
+
+    tty_cache cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.version = TTY_CACHE_VERSION;
+    snprintf(cache.key.out_path, sizeof(cache.key.out_path), "%s", out_path);
+    unsigned int fb_geometry[] = {
+        vinfo.xres, vinfo.yres, vinfo.xres_virtual, vinfo.yres_virtual,
+        vinfo.bits_per_pixel, vinfo.red.offset, vinfo.green.offset, vinfo.blue.offset
+    };
+    memcpy(cache.key.fb_geometry, fb_geometry, sizeof(fb_geometry));
+    unsigned short winsize[] = {winfo.ws_row, winfo.ws_col, winfo.ws_xpixel, winfo.ws_ypixel};
+    memcpy(cache.key.winsize, winsize, sizeof(winsize));
+
+    char cache_path[300];
+    int has_path = use_cache && tty_cache_path(cache_path, sizeof(cache_path)) == 0;
+
+    tty_cache cached;
+    int changed = 0;
+    if (has_path && tty_cache_load(cache_path, &cached) == 0
+            && memcmp(&cached.key, &cache.key, sizeof(cache.key)) == 0) {
+        cache = cached;
+        // tmux pane can be moved or swapped without resize, so its offset is asked every time
+        if (getenv("TMUX") != NULL) {
+            int span = stats_begin(&stats, "tmux query");
+            get_tty_offset(cache.tty_offset);
+            stats_end(&stats, span, 0);
+        }
+    } else {
+        cache.line_length = finfo.line_length;
+        cache.ypanstep = finfo.ypanstep;
+        cache.can_vsync = -1;   // not probed yet
+        cache.visual = finfo.visual;
+        int span = stats_begin(&stats, "terminal query");
+        get_cell_size(cache.cell_size);
+        stats_end(&stats, span, 0);
+        span = stats_begin(&stats, "tmux query");
+        get_tty_offset(cache.tty_offset);
+        stats_end(&stats, span, 0);
+        changed = 1;
+    }
+    if (want_vsync && cache.can_vsync == -1) {
+        cache.can_vsync = fb_probe_vsync(fbfd);
+        changed = 1;
+    }
+    if (has_path && changed)
+        tty_cache_store(cache_path, &cache);
+
+    info->line_length = cache.line_length;
+    memcpy(info->cell_size, cache.cell_size, sizeof(info->cell_size));
+    memcpy(info->tty_offset, cache.tty_offset, sizeof(info->tty_offset));
+    info->ypanstep = cache.ypanstep;
+    info->can_vsync = cache.can_vsync == 1;
+    info->visual = cache.visual;
+
+    // fastest way to write this framebuffer, if it was calibrated
+    info->fbfd = fbfd;
+    info->blit.strategy = BLIT_STREAM;
+    info->blit.threads = 1;
+    char choice_path[300];
+    if (blit_choice_path(finfo.id, vinfo.xres, vinfo.yres, vinfo.bits_per_pixel, choice_path, sizeof(choice_path)) == 0)
+        blit_choice_load(choice_path, &info->blit);
+
+    if (info->terminal_size[0] == 0 || info->terminal_size[1] == 0) {
+        int sideways = fb_rotate_is_sideways(info->rotation);
+        info->terminal_size[0] = info->resolution[sideways] / info->cell_size[0];
+        info->terminal_size[1] = info->resolution[!sideways] / info->cell_size[1];
+    }
+    return 0;
+}
+
+/**
+ * Read *fd* to its end into anonymous mapping, for pipes and files that
+ * can't be mapped. Result is released with munmap like mapped file.
+ */
+unsigned char* read_file(int fd, size_t* size) {
+    size_t capacity = 1 << 16, length = 0;
+    unsigned char* file = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (file == MAP_FAILED)
+        return NULL;
+    for (;;) {
+        if (length == capacity) {
+            // decoder takes length as int
+            if (capacity > INT_MAX / 2) {
+                munmap(file, capacity);
+                errno = EFBIG;
+                return NULL;
+            }
+            unsigned char* grown = mremap(file, capacity, capacity * 2, MREMAP_MAYMOVE);
+            if (grown == MAP_FAILED) {
+                munmap(file, capacity);
+                return NULL;
+            }
+            file = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, file + length, capacity - length);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            int error = n == 0 ? EINVAL : errno;
+            if (n == 0 && length > 0) {
+                unsigned char* shrunk = mremap(file, capacity, length, 0);
+                if (shrunk != MAP_FAILED) {
+                    *size = length;
+                    return shrunk;
+                }
+                error = errno;
+            }
+            munmap(file, capacity);
+            errno = error;
+            return NULL;
+        }
+        length += n;
+    }
+}
+
+/**
+ * Map whole file at *path* read-only, or read it if it's not a regular
+ * file or can't be mapped. Returns NULL (with errno set) on failure.
+ */
+unsigned char* map_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    unsigned char* file = MAP_FAILED;
+    if (S_ISREG(st.st_mode)) {
+        // decoder takes length as int
+        if (st.st_size == 0 || st.st_size > INT_MAX) {
+            close(fd);
+            errno = st.st_size == 0 ? EINVAL : EFBIG;
+            return NULL;
+        }
+        file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        *size = st.st_size;
+    }
+    if (file == MAP_FAILED)
+        file = read_file(fd, size);
+    int error = errno;
+    close(fd);
+    errno = error;
+    return file;
+}
+
+/**
+ * Estimate peak memory stb_image needs to decode *file* of *width* x
+ * *height* pixels with *channels* into *req_channels*, from buffers it
+ * holds at once: for PNG compressed data, inflated rows and unfiltered
+ * image, for JPEG component planes, coefficients of progressive image and
+ * result. QOI is decoded straight into result. Other formats are counted
+ * as two RGBA copies and result.
+ */
+size_t decode_memory(const unsigned char* file, size_t file_size, int width, int height,
+                     int channels, int req_channels) {
+    size_t pixels = (size_t) width * height;
+    size_t result = pixels * req_channels;
+    if (file_size >= 4 && memcmp(file, "\x89PNG", 4) == 0) {
+        size_t decoded = pixels * channels * (stbi_is_16_bit_from_memory(file, file_size) ? 2 : 1);
+        return file_size + (decoded + height) + decoded + result;
+    }
+    if (file_size >= 2 && file[0] == 0xFF && file[1] == 0xD8)
+        return pixels * channels * 3 + result;
+    if (file_size >= 4 && memcmp(file, "qoif", 4) == 0)
+        return result;
+    return pixels * 4 * 2 + result;
+}
+
+// Why built-in QOI decoder failed, NULL when failure was stb_image's
+static const char* qoi_failure = NULL;
+
+/**
+ * Get size and channels of image in *file*, QOI or any format stb_image
+ * reads. Returns 1 if image is known.
+ */
+int image_info(const unsigned char* file, size_t file_size, int* width, int* height, int* channels) {
+    return qoi_info(file, file_size, width, height, channels)
+        || stbi_info_from_memory(file, file_size, width, height, channels);
+}
+
+/**
+ * Decode *file* into RGB(A) pixels of *req_channels*, taken from decoder
+ * arena and freed by stbi_image_free. QOI is decoded by built-in decoder,
+ * it's many times faster than inflating PNG. Other formats go to stb_image.
+ * Returns NULL on failure, decode_failure_reason tells why.
+ */
+unsigned char* decode_image(const unsigned char* file, size_t file_size, int* width, int* height,
+                            int* channels, int req_channels) {
+    qoi_failure = NULL;
+    if (!qoi_info(file, file_size, width, height, channels))
+        return stbi_load_from_memory(file, file_size, width, height, channels, req_channels);
+    unsigned char* data = fb_arena_alloc((size_t) *width * *height * req_channels);
+    if (data == NULL) {
+        qoi_failure = "outofmem";
+        return NULL;
+    }
+    if (qoi_decode(file, file_size, data, req_channels) == -1) {
+        fb_arena_free(data);
+        qoi_failure = "truncated QOI data";
+        return NULL;
+    }
+    return data;
+}
+
+const char* decode_failure_reason(void) {
+    return qoi_failure != NULL ? qoi_failure : stbi_failure_reason();
+}
+
+/**
+ * Parse size in bytes with optional K, M or G suffix (powers of 1024).
+ * Returns 0 if *text* isn't a size.
+ */
+size_t parse_size(const char* text) {
+    char* end;
+    unsigned long long size = strtoull(text, &end, 10);
+    if (end == text || text[0] == '-')
+        return 0;
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || size > (SIZE_MAX >> shift))
+        return 0;
+    return (size_t) size << shift;
+}
+
+/**
+ * Cut image down to *crop* (x, y, width and height as seen on console)
+ * moved by *scroll* cells of *cell_size*. Kept rows are moved in place to
+ * front of *data*, so nothing outside of crop is ever converted.
+ * *data_size*, *width* and *height* are updated.
+ * Returns -1 if no part of image is left.
+ */
+int crop_image(unsigned char* data, int* data_size, int channels, int orientation,
+               const int* crop, const int* scroll, const int* cell_size, int* width, int* height) {
+    int x0 = crop[0] + scroll[0] * cell_size[0], y0 = crop[1] + scroll[1] * cell_size[1];
+    int x1 = x0 + crop[2], y1 = y0 + crop[3];
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > *width) x1 = *width;
+    if (y1 > *height) y1 = *height;
+    if (x1 <= x0 || y1 <= y0)
+        return -1;
+
+    // crop is given in image as seen, find it in decoded pixels
+    int shown[2] = {*width, *height};
+    int src_pos[2], src_size[2];
+    fb_rotate_rect(fb_rotate_inverse(orientation), shown, (int[]){x0, y0}, (int[]){x1 - x0, y1 - y0},
+                   src_pos, src_size);
+    size_t line_length = (size_t) data_size[0] * channels, row = (size_t) src_size[0] * channels;
+    for (int y = 0; y < src_size[1]; y++)
+        memmove(data + y * row, data + (src_pos[1] + y) * line_length + src_pos[0] * channels, row);
+
+    data_size[0] = src_size[0];
+    data_size[1] = src_size[1];
+    *width = x1 - x0;
+    *height = y1 - y0;
+    return 0;
+}
+
+// color map replaced by installed palette, put back at exit
+static fb_palette_saved saved_cmap;
+static int saved_cmap_fd = -1;
+
+static void restore_cmap(void) {
+    if (saved_cmap_fd != -1)
+        fb_palette_restore(saved_cmap_fd, &saved_cmap);
+}
+
+static void restore_cmap_and_die(int signum) {
+    restore_cmap();
+    signal(signum, SIG_DFL);
+    raise(signum);
+}
+
+/**
+ * Save color map of *fbfd* to be put back when program exits or is killed
+ * by signal. Own descriptor is kept, framebuffer may be closed before exit.
+ */
+void save_cmap(int fbfd, int bits_per_pixel) {
+    if (saved_cmap_fd != -1 || fb_palette_save(fbfd, bits_per_pixel, &saved_cmap) == -1)
+        return;
+    saved_cmap_fd = dup(fbfd);
+    if (saved_cmap_fd == -1)
+        return;
+    atexit(restore_cmap);
+    struct sigaction action = {0};
+    action.sa_handler = restore_cmap_and_die;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+    sigaction(SIGQUIT, &action, NULL);
+}
+
+/**
+ * Set up palette of pseudocolor framebuffer for conversion of images:
+ * current one, or color cube installed when *install* is set or current
+ * palette can't be read. Virtual framebuffer (*virt*) has standard palette.
+ * Installed palette is replaced by previous one at exit.
+ * Returns NULL on failure.
+ */
+fb_palette* init_palette(int fbfd, const fb_virtual* virt, term_info *info, int install) {
+    fb_palette* palette = malloc(sizeof(fb_palette));
+    if (palette == NULL)
+        return NULL;
+    int bits_per_pixel = info->format.bytes_per_pixel * 8;
+    int can_install = info->visual == FB_VISUAL_PSEUDOCOLOR;
+    int ready = 0;
+    if (virt != NULL) {
+        fb_palette_standard(palette);
+        ready = 1;
+    }
+    if (!ready && !install)
+        ready = fb_palette_read(fbfd, bits_per_pixel, palette) == 0;
+    if (!ready && can_install) {
+        save_cmap(fbfd, bits_per_pixel);
+        ready = fb_palette_install(fbfd, bits_per_pixel, palette) == 0;
+    }
+    if (!ready && install)
+        ready = fb_palette_read(fbfd, bits_per_pixel, palette) == 0;
+    if (!ready) {
+        free(palette);
+        return NULL;
+    }
+    fb_palette_build_lut(palette);
+    info->format.palette = palette->colors[0];
+    info->format.palette_lut = palette->lut;
+    return palette;
+}
+
+
 typedef struct {
     int begin_pos[2];
     int begin_pos_px[2];
@@ -78,12 +626,12 @@ typedef enum {
  * Assign position to cursor.
  * *mode* decides where cursor ends up after writing image.
  */
-void init_cursor(cursor *cur, cursor_mode mode, int indent, int* cell_size, int image_lines, int image_cols) {
+void init_cursor(cursor *cur, cursor_mode mode, int indent, const term_info *info, int image_lines, int image_cols) {
     // top-left position starts from (1, 1) but (0, 0) is needed
     int margin[] = {-1, -1};
     get_cursor_mpos(margin, cur->begin_pos);
     cur->begin_pos[0] += indent;
-    get_cursor_pos_px(cur->begin_pos, cell_size, cur->begin_pos_px); 
+    get_cursor_pos_px(cur->begin_pos, info->tty_offset, info->cell_size, cur->begin_pos_px); 
   
     get_cursor_mpos(margin, cur->end_pos);
     
@@ -101,42 +649,1111 @@ void init_cursor(cursor *cur, cursor_mode mode, int indent, int* cell_size, int
 
 
 typedef struct {
-    int line_length;        // length of line in bytes 
-    long screen_size;       // size of screen in bytes, used in mmap
-    int terminal_size[2];   // size of terminal (or pane) in columns and lines
-} term_info;
+    unsigned char* data;    // decoded image, RGB or premultiplied BGRA
+    int data_size[2];       // size of decoded image in pixels
+    int orientation;        // how data is turned on framebuffer: EXIF orientation, then console rotation
+    int width, height;      // size of whole image in pixels, as seen on console
+    int channels;           // 3, or 4 for image with alpha
+    int line_length;        // length of line of data in bytes
+    int background;         // 0xRRGGBB to blend image with alpha over, -1 for screen
+    int pos[2];             // left-top corner relative to pane in columns and lines
+    int indent;
+    int exceed[2];          // columns and lines of image which don't fit in pane
+    int visible_size[2];    // size of drawn part of image in pixels, as seen on console
+    shadow_fb shadow;       // drawn part in framebuffer format, if kept
+} placement;
 
 /**
- * Assign information about terminal.
- * *fbfd* - file descriptor of framebuffer device.
+ * Calculate which part of image placed at *place->pos* fits in terminal (pane).
  */
-void init_term_info(int fbfd, term_info *info) {
+void clip_placement(const term_info *info, placement *place) {
+    const int* cell_size = info->cell_size;
+    int image_lines = ceil((double) place->height / cell_size[1]);
+    int image_cols = ceil((double) place->width / cell_size[0]);
+
+    place->visible_size[0] = place->width;
+    place->visible_size[1] = place->height;
+
+    place->exceed[1] = place->pos[1] + image_lines - info->terminal_size[1];
+    if (place->exceed[1] > 0)
+        place->visible_size[1] -= (place->exceed[1]+1)*cell_size[1];
+
+    place->exceed[0] = place->pos[0] + place->indent + image_cols - info->terminal_size[0];
+    if (place->exceed[0] > 0)
+        place->visible_size[0] -= place->exceed[0]*cell_size[0];
+}
+
+/**
+ * Get region of framebuffer covered by visible part of image, turned when
+ * console is rotated, and position of that part in image as it appears
+ * on framebuffer (*src_pos*).
+ */
+void placement_region(const term_info *info, const placement *place, int* pos_px, int* size, int* src_pos) {
+    int sideways = fb_rotate_is_sideways(info->rotation);
+    int screen[2] = {info->resolution[sideways], info->resolution[!sideways]};
+    int console_pos[2];
+    get_cursor_pos_px(place->pos, info->tty_offset, info->cell_size, console_pos);
+    fb_rotate_rect(info->rotation, screen, console_pos, place->visible_size, pos_px, size);
+
+    int image[2] = {place->width, place->height};
+    int src_size[2];
+    fb_rotate_rect(info->rotation, image, (int[]){0, 0}, place->visible_size, src_pos, src_size);
+}
+
+// Rows of turned image taken at once, small enough to stay in L2 cache
+#define BAND_ROWS 16
+
+/**
+ * Get *rows* rows from *y* of *width* pixels wide part of image at
+ * *src_pos*, as they appear on framebuffer. Upright image is used in place,
+ * rows of turned one are copied into *band*. Sets *line_length* of rows.
+ */
+const unsigned char* placement_rows(const placement *place, const int* src_pos, int width, int y, int rows,
+                                    unsigned char* band, int* line_length) {
+    if (place->orientation == FB_ROTATE_UR) {
+        *line_length = place->line_length;
+        return place->data + (long) (src_pos[1] + y) * place->line_length + src_pos[0] * place->channels;
+    }
+    *line_length = width * place->channels;
+    fb_rotate_region(place->data, place->line_length, place->data_size[0], place->data_size[1],
+                     place->channels, place->orientation, (int[]){src_pos[0], src_pos[1] + y},
+                     (int[]){width, rows}, band, *line_length);
+    return band;
+}
+
+/**
+ * Get number of rows to convert at once and allocate *band* for them
+ * when image is turned. Returns 0 if band couldn't be allocated.
+ */
+int placement_band(const term_info *info, const placement *place, const int* size, unsigned char** band) {
+    *band = NULL;
+    if (place->orientation == FB_ROTATE_UR)
+        return size[1];
+    // Floyd-Steinberg carries error through whole height, it gets all rows at once
+    int rows = place->channels == 3 && info->dither == DITHER_FS ? size[1] : BAND_ROWS;
+    *band = malloc((size_t) rows * size[0] * place->channels);
+    return *band != NULL ? rows : 0;
+}
+
+/**
+ * Set up shadow of screen region covered by visible part of image.
+ * With *load_underlay* current screen content is read into shadow first
+ * (one pass of uncached reads), which is needed before saving region under
+ * image. Image with alpha and without background always loads it, to blend
+ * over it. Call after clip_placement.
+ */
+void shadow_placement(const term_info *info, placement *place, const char* fb_ptr, int load_underlay) {
+    shadow_fb_free(&place->shadow);
+    int width = place->visible_size[0], height = place->visible_size[1];
+    if (width <= 0 || height <= 0)
+        return;
+    int pos_px[2], size[2], src_pos[2];
+    placement_region(info, place, pos_px, size, src_pos);
+    if (shadow_fb_init(&place->shadow, pos_px, size, info->format.bytes_per_pixel) == -1)
+        return;
+    if (load_underlay || (place->channels == 4 && place->background < 0))
+        shadow_fb_load(&place->shadow, (const unsigned char*) fb_ptr, info->line_length);
+}
+
+/**
+ * Convert or blend image into its shadow and mark changed spans dirty.
+ * Fully transparent rows of image stay clean.
+ */
+void render_placement(const term_info *info, placement *place) {
+    shadow_fb* shadow = &place->shadow;
+    if (shadow->pixels == NULL)
+        return;
+    int pos_px[2], size[2], src_pos[2];
+    placement_region(info, place, pos_px, size, src_pos);
+    unsigned char* band;
+    int band_rows = placement_band(info, place, size, &band);
+    int* spans = NULL;
+    if (place->channels == 4)
+        spans = malloc(sizeof(int) * 2 * size[1]);
+    if (band_rows == 0 || (place->channels == 4 && spans == NULL)) {
+        free(band);
+        free(spans);
+        return;
+    }
+
+    if (place->channels == 4 && place->background >= 0) {
+        fill_rows(shadow->pixels, shadow->line_length, size[0], size[1], place->background);
+        shadow_fb_mark(shadow, 0, 0, size[0], size[1]);
+    }
+    for (int y = 0; y < size[1]; y += band_rows) {
+        int rows = size[1] - y < band_rows ? size[1] - y : band_rows;
+        int src_line_length;
+        const unsigned char* src = placement_rows(place, src_pos, size[0], y, rows, band, &src_line_length);
+        unsigned char* out = shadow->pixels + (size_t) y * shadow->line_length;
+        if (place->channels == 3)
+            convert_image(src, src_line_length, size[0], rows, out, shadow->line_length,
+                          &info->format, info->dither, (int[]){pos_px[0], pos_px[1] + y});
+        else
+            composite_bgra_rows(src, src_line_length, size[0], rows, out, shadow->line_length, spans + y*2);
+    }
+
+    if (place->channels == 3)
+        shadow_fb_mark(shadow, 0, 0, size[0], size[1]);
+    for (int y = 0; spans != NULL && y < size[1]; y++)
+        if (spans[y*2] != -1)
+            shadow_fb_mark(shadow, spans[y*2], y, spans[y*2+1] - spans[y*2], 1);
+    free(spans);
+    free(band);
+}
+
+typedef struct {
+    const term_info *info;
+    const placement *place;
+    char* fb_ptr;
+    const int* pos_px;
+    const int* size;
+    const int* src_pos;
+    int rows[2];            // first and last+1 row of region written by job
+} stream_job;
+
+// Write *len* bytes of row from *src* to *dst* in framebuffer with info->blit strategy
+static void write_span(const term_info *info, const char* fb_ptr, unsigned char* dst,
+                       const unsigned char* src, int len) {
+    switch (info->blit.strategy) {
+        case BLIT_MEMCPY:
+            memcpy(dst, src, len);
+            break;
+        case BLIT_PWRITE:
+            if (pwrite(info->fbfd, src, len, (char*) dst - fb_ptr) == len)
+                break;
+            memcpy(dst, src, len);
+            break;
+        default:
+            stream_copy(dst, src, len);
+    }
+}
+
+/**
+ * Convert rows of *job* band by band and write them to framebuffer.
+ */
+static void* stream_rows(void* arg) {
+    const stream_job* job = arg;
+    const term_info *info = job->info;
+    const placement *place = job->place;
+    const int* size = job->size;
+    int bytes_per_pixel = info->format.bytes_per_pixel;
+    // plain stores convert straight into framebuffer, others go through band in cache
+    int direct = info->blit.strategy == BLIT_STORE;
+    int out_line_length = size[0] * bytes_per_pixel;
+    unsigned char* out = NULL;
+    unsigned char* band = NULL;
+    if (!direct)
+        out = malloc((size_t) BAND_ROWS * out_line_length);
+    if (place->orientation != FB_ROTATE_UR)
+        band = malloc((size_t) BAND_ROWS * size[0] * place->channels);
+    if ((!direct && out == NULL) || (place->orientation != FB_ROTATE_UR && band == NULL)) {
+        free(out);
+        free(band);
+        return NULL;
+    }
+
+    unsigned char* fb_loc = (unsigned char*) job->fb_ptr + (long) job->pos_px[1] * info->line_length
+                                                         + job->pos_px[0] * bytes_per_pixel;
+    int spans[BAND_ROWS * 2];
+    for (int y = job->rows[0]; y < job->rows[1]; y += BAND_ROWS) {
+        int rows = job->rows[1] - y < BAND_ROWS ? job->rows[1] - y : BAND_ROWS;
+        int src_line_length;
+        const unsigned char* src = placement_rows(place, job->src_pos, size[0], y, rows, band, &src_line_length);
+        unsigned char* dst = fb_loc + (long) y * info->line_length;
+        unsigned char* to = direct ? dst : out;
+        int to_line_length = direct ? info->line_length : out_line_length;
+
+        if (place->channels == 4 && place->background < 0) {
+            if (!direct)
+                copy_rows(dst, info->line_length, out, out_line_length, out_line_length, rows);
+            composite_bgra_rows(src, src_line_length, size[0], rows, to, to_line_length, spans);
+        } else {
+            if (place->channels == 4) {
+                fill_rows(to, to_line_length, size[0], rows, place->background);
+                composite_bgra_rows(src, src_line_length, size[0], rows, to, to_line_length, spans);
+            } else {
+                convert_image(src, src_line_length, size[0], rows, to, to_line_length,
+                              &info->format, info->dither, (int[]){job->pos_px[0], job->pos_px[1] + y});
+            }
+            for (int r = 0; r < rows; r++) {
+                spans[r*2] = 0;
+                spans[r*2+1] = size[0];
+            }
+        }
+
+        for (int r = 0; r < rows && !direct; r++)
+            if (spans[r*2] != -1)
+                write_span(info, job->fb_ptr, dst + (long) r * info->line_length + spans[r*2] * bytes_per_pixel,
+                           out + (size_t) r * out_line_length + spans[r*2] * bytes_per_pixel,
+                           (spans[r*2+1] - spans[r*2]) * bytes_per_pixel);
+    }
+    if (info->blit.strategy == BLIT_STREAM)
+        store_fence();
+    free(out);
+    free(band);
+    return NULL;
+}
+
+/**
+ * Draw placement without shadow, in bands of rows small enough to stay in
+ * L2 cache. Each band is turned, converted or blended over screen content
+ * and streamed to device before next one is touched, so decoded image is
+ * read once and device memory is written once (and read once under image
+ * with alpha and without background).
+ */
+void stream_placement(const term_info *info, const placement *place, char* fb_ptr,
+                      const int* pos_px, const int* size, const int* src_pos) {
+    // rows are split between threads in whole bands
+    int bands = (size[1] + BAND_ROWS - 1) / BAND_ROWS;
+    int threads = info->blit.threads < bands ? info->blit.threads : bands;
+    if (threads < 1)
+        threads = 1;
+    if (threads > BLIT_MAX_THREADS)
+        threads = BLIT_MAX_THREADS;
+
+    stream_job jobs[BLIT_MAX_THREADS];
+    pthread_t ids[BLIT_MAX_THREADS];
+    int started[BLIT_MAX_THREADS] = {0};
+    for (int i = 0; i < threads; i++) {
+        jobs[i] = (stream_job) {info, place, fb_ptr, pos_px, size, src_pos, {
+            bands * i / threads * BAND_ROWS, bands * (i+1) / threads * BAND_ROWS
+        }};
+        if (jobs[i].rows[1] > size[1])
+            jobs[i].rows[1] = size[1];
+    }
+    for (int i = 1; i < threads; i++) {
+        started[i] = pthread_create(&ids[i], NULL, stream_rows, &jobs[i]) == 0;
+        if (!started[i])
+            stream_rows(&jobs[i]);
+    }
+    stream_rows(&jobs[0]);
+    for (int i = 1; i < threads; i++)
+        if (started[i])
+            pthread_join(ids[i], NULL);
+}
+
+void draw_placement(const term_info *info, placement *place, char* fb_ptr) {
+    if (place->visible_size[0] <= 0 || place->visible_size[1] <= 0)
+        return;
+    if (place->shadow.pixels != NULL) {
+        shadow_fb_flush(&place->shadow, (unsigned char*) fb_ptr, info->line_length);
+        return;
+    }
+    int pos_px[2], size[2], src_pos[2];
+    placement_region(info, place, pos_px, size, src_pos);
+    if (place->channels == 4 || info->dither != DITHER_FS) {
+        stream_placement(info, place, fb_ptr, pos_px, size, src_pos);
+        return;
+    }
+
+    // error diffusion runs through all rows, image is converted straight to device
+    unsigned char* band;
+    int band_rows = placement_band(info, place, size, &band);
+    for (int y = 0; y < size[1] && band_rows > 0; y += band_rows) {
+        int rows = size[1] - y < band_rows ? size[1] - y : band_rows;
+        int src_line_length;
+        const unsigned char* src = placement_rows(place, src_pos, size[0], y, rows, band, &src_line_length);
+        write_image((int[]){pos_px[0], pos_px[1] + y}, size[0], rows, src_line_length, info->line_length,
+                    (unsigned char*) src, fb_ptr, &info->format, info->dither);
+    }
+    free(band);
+}
+
+/**
+ * Draw placement whose data is already in framebuffer format (raw image),
+ * copying rows of visible part with info->blit strategy.
+ */
+void copy_placement(const term_info *info, const placement *place, char* fb_ptr) {
+    if (place->visible_size[0] <= 0 || place->visible_size[1] <= 0)
+        return;
+    int pos_px[2], size[2], src_pos[2];
+    placement_region(info, place, pos_px, size, src_pos);
+    int bytes_per_pixel = info->format.bytes_per_pixel;
+    unsigned char* dst = (unsigned char*) fb_ptr + (long) pos_px[1] * info->line_length + pos_px[0] * bytes_per_pixel;
+    const unsigned char* src = place->data + (long) src_pos[1] * place->line_length + src_pos[0] * bytes_per_pixel;
+    for (int y = 0; y < size[1]; y++)
+        write_span(info, fb_ptr, dst + (long) y * info->line_length, src + (long) y * place->line_length,
+                   size[0] * bytes_per_pixel);
+    if (info->blit.strategy == BLIT_STREAM || info->blit.strategy == BLIT_STORE)
+        store_fence();
+}
+
+/**
+ * Draw placement as one frame without tearing: into hidden page which is
+ * then shown, or at vertical blank when there is no room for second page.
+ * Both pages end up with the same image. Without *pages* it's draw_placement.
+ */
+void present_placement(const term_info *info, placement *place, char* fb_ptr, fb_pages *pages) {
+    shadow_fb* shadow = &place->shadow;
+    if (pages == NULL || shadow->pixels == NULL) {
+        draw_placement(info, place, fb_ptr);
+        return;
+    }
+    if (fb_pages_back(pages) == NULL) {
+        fb_pages_wait(pages);
+        draw_placement(info, place, fb_pages_front(pages) != NULL ? fb_pages_front(pages) : fb_ptr);
+        return;
+    }
+
+    size_t dirty_size = sizeof(int) * 2 * shadow->size[1];
+    int* dirty = malloc(dirty_size);
+    if (dirty != NULL)
+        memcpy(dirty, shadow->dirty, dirty_size);
+    shadow_fb_flush(shadow, (unsigned char*) fb_pages_back(pages), info->line_length);
+    fb_pages_flip(pages);
+
+    // bring page which was just hidden up to date
+    if (dirty != NULL)
+        memcpy(shadow->dirty, dirty, dirty_size);
+    else
+        shadow_fb_mark(shadow, 0, 0, shadow->size[0], shadow->size[1]);
+    shadow_fb_flush(shadow, (unsigned char*) fb_pages_back(pages), info->line_length);
+    free(dirty);
+}
+
+/**
+ * Compare screen with shadow of image and write back rows which were overwritten.
+ * *damaged* must have room for one byte per visible row.
+ * Returns number of repaired rows.
+ */
+int repair_placement(const term_info *info, placement *place, char* fb_ptr, unsigned char* damaged) {
+    shadow_fb* shadow = &place->shadow;
+    if (shadow->pixels == NULL)
+        return 0;
+    const unsigned char* fb_loc = (const unsigned char*) fb_ptr
+        + shadow->pos_px[0] * shadow->bytes_per_pixel + shadow->pos_px[1] * info->line_length;
+
+    int count = find_damaged_rows(fb_loc, info->line_length, shadow->pixels, shadow->line_length,
+                                  shadow->line_length, shadow->size[1], damaged);
+    if (count == 0)
+        return 0;
+    for (int y = 0; y < shadow->size[1]; y++)
+        if (damaged[y])
+            shadow_fb_mark(shadow, 0, y, shadow->size[0], 1);
+    shadow_fb_flush(shadow, (unsigned char*) fb_ptr, info->line_length);
+    return count;
+}
+
+
+/**
+ * Save screen region which image is about to cover, so `fbtty --clear=<id>`
+ * can restore it. Region is taken from shadow loaded by
+ * shadow_placement(..., 1), call before render_placement.
+ */
+int save_placement_under(const placement *place, const char* id) {
+    char path[300];
+    if (save_under_path(id, path, sizeof(path)) == -1)
+        return -1;
+    const shadow_fb* shadow = &place->shadow;
+    if (shadow->pixels == NULL)
+        return place->visible_size[0] <= 0 || place->visible_size[1] <= 0 ? 0 : -1;
+    return save_under_store(path, shadow->pixels, shadow->line_length, shadow->pos_px,
+                            shadow->bytes_per_pixel, shadow->line_length, shadow->size[1]);
+}
+
+/**
+ * Restore region saved with --save-under=<id> on *out_path* device
+ * (virtual framebuffer *virt* kept in that file if it's not NULL).
+ * Terminal isn't queried, region remembers its position in pixels.
+ */
+int clear_saved_region(const char* out_path, const fb_virtual* virt, const char* id) {
+    char path[300];
+    if (save_under_path(id, path, sizeof(path)) == -1) {
+        fprintf(stderr, "Error: invalid id '%s'\n", id);
+        return 1;
+    }
+
+    int fbfd = open(out_path, O_RDWR);
+    if (fbfd == -1) {
+        fprintf(stderr, "Error: output device %s not found\n", out_path);
+        return 1;
+    }
+
+    struct fb_fix_screeninfo finfo;
+    struct fb_var_screeninfo vinfo;
+    if (get_screen_info(fbfd, virt, &vinfo, &finfo) == -1) {
+        fprintf(stderr, "Error: %s is not a framebuffer device\n", out_path);
+        close(fbfd);
+        return 1;
+    }
+    long screen_size = (long) finfo.line_length * vinfo.yres;
+
+    char* fb_ptr = (char*) mmap(0, screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
+    if ((long) fb_ptr == -1) {
+        fprintf(stderr, "Error: failed to map framebuffer\n");
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        close(fbfd);
+        return 1;
+    }
+
+    int ret = save_under_restore(path, (unsigned char*) fb_ptr, finfo.line_length, screen_size,
+                                 vinfo.bits_per_pixel / 8);
+    if (ret == -1)
+        fprintf(stderr, "Error: no saved region '%s' fitting %s\n", id, out_path);
+
+    munmap(fb_ptr, screen_size);
+    close(fbfd);
+    return ret == -1;
+}
+
+
+// Passes over screen for every strategy and thread count, best one counts
+#define CALIBRATE_RUNS 3
+
+/**
+ * Time every way of writing framebuffer at *out_path* (virtual one if *virt*
+ * isn't NULL) with whole screen of gradient and save the fastest for later
+ * runs. Screen content is put back after. Returns exit status.
+ */
+int calibrate_blit(const char* out_path, const fb_virtual* virt, int has_out_path, int use_cache) {
+    int fbfd = virt != NULL ? fb_virtual_open(has_out_path ? out_path : NULL, virt) : open(out_path, O_RDWR);
+    if (fbfd == -1) {
+        fprintf(stderr, "Error: output device %s not found\n", out_path);
+        return 1;
+    }
+    term_info info;
+    int status = init_term_info(fbfd, virt, out_path, use_cache, 0, &info);
+    if (status == -2)
+        fprintf(stderr, "Error: pixel format of %s is not supported\n", out_path);
+    else if (status == -1)
+        fprintf(stderr, "Error: %s is not a framebuffer device, use --virtual-fb for plain files\n", out_path);
+    if (status < 0) {
+        close(fbfd);
+        return 1;
+    }
     struct fb_fix_screeninfo finfo;
-    ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo);
-   
     struct fb_var_screeninfo vinfo;
-    ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo);
+    get_screen_info(fbfd, virt, &vinfo, &finfo);
+    char choice_path[300];
+    if (blit_choice_path(finfo.id, vinfo.xres, vinfo.yres, vinfo.bits_per_pixel, choice_path, sizeof(choice_path)) == -1) {
+        fprintf(stderr, "Error: no cache directory to save calibration in\n");
+        close(fbfd);
+        return 1;
+    }
+
+    fb_palette* palette = NULL;
+    if (info.visual == FB_VISUAL_PSEUDOCOLOR || info.visual == FB_VISUAL_STATIC_PSEUDOCOLOR) {
+        if (info.format.bytes_per_pixel == 1)
+            palette = init_palette(fbfd, virt, &info, 0);
+        if (palette == NULL) {
+            fprintf(stderr, "Error: palette of %s couldn't be used\n", out_path);
+            close(fbfd);
+            return 1;
+        }
+    }
+    char* fb_ptr = (char*) mmap(0, info.screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
+    if ((long) fb_ptr == -1) {
+        fprintf(stderr, "Error: failed to map framebuffer\n");
+        fprintf(stderr, "mmap: %s\n", strerror(errno));
+        free(palette);
+        close(fbfd);
+        return 1;
+    }
+
+    // image covers whole screen as console shows it
+    int sideways = fb_rotate_is_sideways(info.rotation);
+    int width = info.resolution[sideways], height = info.resolution[!sideways];
+    unsigned char* saved = malloc(info.screen_size);
+    unsigned char* data = malloc((size_t) width * height * 3);
+    if (saved == NULL || data == NULL) {
+        fprintf(stderr, "Error: not enough memory for calibration\n");
+        free(saved);
+        free(data);
+        munmap(fb_ptr, info.screen_size);
+        free(palette);
+        close(fbfd);
+        return 1;
+    }
+    memcpy(saved, fb_ptr, info.screen_size);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            unsigned char* pixel = data + ((size_t) y * width + x) * 3;
+            pixel[0] = x * 255 / width;
+            pixel[1] = y * 255 / height;
+            pixel[2] = (x + y) * 255 / (width + height);
+        }
+    info.tty_offset[0] = info.tty_offset[1] = 0;
+    info.dither = DITHER_ORDERED;
+    placement place = {
+        .data = data, .data_size = {width, height}, .orientation = info.rotation,
+        .width = width, .height = height, .channels = 3, .line_length = width * 3,
+        .background = -1, .visible_size = {width, height}
+    };
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    blit_choice best = {BLIT_STREAM, 1};
+    double best_time = -1;
+    for (int strategy = 0; strategy < BLIT_STRATEGIES; strategy++)
+        for (int threads = 1; threads <= BLIT_MAX_THREADS && (threads == 1 || threads <= cpus); threads *= 2) {
+            info.blit = (blit_choice) {strategy, threads};
+            double time = -1;
+            for (int run = 0; run < CALIBRATE_RUNS; run++) {
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                draw_placement(&info, &place, fb_ptr);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                double run_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+                if (time < 0 || run_time < time)
+                    time = run_time;
+            }
+            printf("%-8s %2d threads %9.3f ms %8.1f MB/s\n", blit_strategy_names[strategy], threads,
+                   time * 1e3, (double) width * height * info.format.bytes_per_pixel / time * 1e-6);
+            if (best_time < 0 || time < best_time) {
+                best_time = time;
+                best = info.blit;
+            }
+        }
+
+    memcpy(fb_ptr, saved, info.screen_size);
+    int ret = blit_choice_store(choice_path, &best);
+    if (ret == -1)
+        fprintf(stderr, "Error: couldn't save calibration to %s\n", choice_path);
+    else
+        printf("Using %s with %d threads, saved to %s\n", blit_strategy_names[best.strategy], best.threads, choice_path);
+
+    free(saved);
+    free(data);
+    munmap(fb_ptr, info.screen_size);
+    free(palette);
+    close(fbfd);
+    return ret == -1;
+}
+
+typedef enum {
+    CONVERT_NONE,
+    CONVERT_RAW,    // pixels in framebuffer format, drawn without decoding
+    CONVERT_QOI     // lossless, decoded many times faster than PNG
+} convert_kind;
+
+/**
+ * Decode image at *img_path* and save it to *out_path* as *kind*, with
+ * EXIF orientation applied. Raw image gets pixel format of framebuffer at
+ * *fb_path*, or of *virt* if it isn't NULL, and alpha blended over
+ * *background* (black if -1). QOI keeps alpha. Returns exit status.
+ */
+int convert_file(const char* img_path, const char* out_path, convert_kind kind, const char* fb_path,
+                 const fb_virtual* virt, dither_mode dither, int background) {
+    fb_format format;
+    if (kind == CONVERT_RAW) {
+        struct fb_var_screeninfo vinfo;
+        struct fb_fix_screeninfo finfo;
+        int fbfd = virt != NULL ? -1 : open(fb_path, O_RDONLY);
+        if (virt == NULL && fbfd == -1) {
+            fprintf(stderr, "Error: output device %s not found\n", fb_path);
+            return 1;
+        }
+        int known = get_screen_info(fbfd, virt, &vinfo, &finfo) == 0;
+        if (fbfd != -1)
+            close(fbfd);
+        if (!known) {
+            fprintf(stderr, "Error: %s is not a framebuffer device, use --virtual-fb to give format\n", fb_path);
+            return 1;
+        }
+        if (get_pixel_format(&vinfo, &format) == -1) {
+            fprintf(stderr, "Error: pixel format of %s is not supported\n", fb_path);
+            return 1;
+        }
+        if (finfo.visual != FB_VISUAL_TRUECOLOR && finfo.visual != FB_VISUAL_DIRECTCOLOR) {
+            fprintf(stderr, "Error: raw images need truecolor framebuffer format\n");
+            return 1;
+        }
+    }
+
+    size_t file_size;
+    unsigned char* file = map_file(img_path, &file_size);
+    if (file == NULL) {
+        fprintf(stderr, "Error: image %s couldn't be loaded: %s\n", img_path, strerror(errno));
+        return 1;
+    }
+    int width, height, channels;
+    int req_channels = 3;
+    if (image_info(file, file_size, &width, &height, &channels) && (channels == 2 || channels == 4))
+        req_channels = 4;
+    unsigned char *data = decode_image(file, file_size, &width, &height, &channels, req_channels);
+    int exif = fb_rotate_from_exif(exif_orientation(file, file_size));
+    munmap(file, file_size);
+    if (data == NULL) {
+        fprintf(stderr, "Error: image %s couldn't be loaded: ", img_path);
+        fprintf(stderr, "%s\n", decode_failure_reason());
+        return 1;
+    }
+    if (kind == CONVERT_RAW && req_channels == 4) {
+        flatten_rgba(data, width, height, background >= 0 ? background : 0);
+        req_channels = 3;
+    }
+
+    // stored upright, so it's drawn as it is
+    int shown[2] = {width, height};
+    if (fb_rotate_is_sideways(exif)) {
+        shown[0] = height;
+        shown[1] = width;
+    }
+    int line_length = kind == CONVERT_RAW ? shown[0] * format.bytes_per_pixel : 0;
+    unsigned char* upright = exif != FB_ROTATE_UR ? malloc((size_t) shown[0] * shown[1] * req_channels) : NULL;
+    unsigned char* pixels = kind == CONVERT_RAW ? malloc((size_t) line_length * shown[1]) : NULL;
+    int ret = 1;
+    if ((kind == CONVERT_RAW && pixels == NULL) || (exif != FB_ROTATE_UR && upright == NULL)) {
+        fprintf(stderr, "Error: not enough memory to convert %s\n", img_path);
+    } else {
+        const unsigned char* image = data;
+        if (upright != NULL) {
+            fb_rotate_region(data, width * req_channels, width, height, req_channels, exif, (int[]){0, 0}, shown,
+                             upright, shown[0] * req_channels);
+            image = upright;
+        }
+        if (kind == CONVERT_RAW) {
+            convert_image(image, shown[0] * 3, shown[0], shown[1], pixels, line_length, &format, dither,
+                          (int[]){0, 0});
+            ret = fb_raw_write(out_path, pixels, line_length, shown[0], shown[1], &format) == -1;
+        } else {
+            ret = qoi_write(out_path, image, shown[0], shown[1], req_channels) == -1;
+        }
+        if (ret)
+            fprintf(stderr, "Error: %s couldn't be written\n", out_path);
+    }
+    free(upright);
+    free(pixels);
+    stbi_image_free(data);
+    return ret;
+}
+
+// time to wait for more resize events before redrawing
+#define FOLLOW_SETTLE_MS 30
+
+static volatile sig_atomic_t quit_requested = 0;
+static int winch_pipe[2] = {-1, -1};
+
+static void request_quit(int signum) {
+    (void) signum;
+    quit_requested = 1;
+}
+
+static void notify_winch(int signum) {
+    (void) signum;
+    int saved_errno = errno;
+    write(winch_pipe[1], "", 1);
+    errno = saved_errno;
+}
+
+/**
+ * Refresh terminal and cell size after SIGWINCH.
+ * Returns 1 if anything changed.
+ */
+int update_term_size(term_info *info) {
+    int old_size[4] = {
+        info->terminal_size[0], info->terminal_size[1], info->cell_size[0], info->cell_size[1]
+    };
 
     struct winsize winfo;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &winfo);
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &winfo) == 0) {
+        info->terminal_size[0] = winfo.ws_col;
+        info->terminal_size[1] = winfo.ws_row;
+    }
+    get_cell_size(info->cell_size);
 
-    info->screen_size = vinfo.xres * vinfo.yres * vinfo.bits_per_pixel / 8;
-    info->line_length = finfo.line_length;
-    info->terminal_size[0] = winfo.ws_col;
-    info->terminal_size[1] = winfo.ws_row;
+    int new_size[4] = {
+        info->terminal_size[0], info->terminal_size[1], info->cell_size[0], info->cell_size[1]
+    };
+    return memcmp(old_size, new_size, sizeof(old_size)) != 0;
+}
+
+/**
+ * Keep image on screen until q, Ctrl-C or end of tmux session.
+ * Image is redrawn when terminal is resized (SIGWINCH) or tmux (control mode)
+ * reports that pane was moved, resized, zoomed or shown again.
+ * Decoded image is kept, so redraw is a blit only. Nothing is done while
+ * pane is hidden or while resize didn't change geometry.
+ * With *keep_ms* > 0 screen is checked that often for overwritten rows.
+ * With *pages* redraws are presented as tear-free frames.
+ */
+void follow_placement(term_info *info, placement *place, char* fb_ptr, int keep_ms, fb_pages *pages) {
+    struct sigaction action = {0};
+    action.sa_handler = request_quit;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+
+    if (pipe(winch_pipe) == 0) {
+        fcntl(winch_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(winch_pipe[1], F_SETFL, O_NONBLOCK);
+        action.sa_handler = notify_winch;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &action, NULL);
+    }
+
+    tmux_control ctl;
+    int has_tmux = tmux_control_open(&ctl) == 0;
+    if (!has_tmux && getenv("TMUX") != NULL)
+        fprintf(stderr, "Error: couldn't attach to tmux in control mode\n");
+
+    struct termios tty, oldtty;
+    int has_tty = tcgetattr(STDIN_FILENO, &oldtty) == 0;
+    if (has_tty) {
+        tty = oldtty;
+        tty.c_lflag &= ~(ICANON|ECHO);
+        tcsetattr(STDIN_FILENO, TCSANOW, &tty);
+    }
+
+    struct pollfd fds[3] = {
+        {has_tty ? STDIN_FILENO : -1, POLLIN, 0},
+        {has_tmux ? ctl.out_fd : -1, POLLIN, 0},
+        {winch_pipe[0], POLLIN, 0}
+    };
+    int relayout_pending = 0;
+    int resized = 0, tmux_changed = 0;
+    int visible = 1;
+    unsigned char* damaged = NULL;
+    if (keep_ms > 0)
+        // shadow rows follow image columns on rotated console
+        damaged = malloc(place->height > place->width ? place->height : place->width > 0 ? place->width : 1);
+
+    while (!quit_requested) {
+        int ready = 1;
+        for (int i = 0; i < 3; i++)
+            fds[i].revents = 0;
+        if (!has_tmux || !tmux_control_buffered(&ctl)) {
+            int timeout = -1;
+            if (relayout_pending)
+                timeout = FOLLOW_SETTLE_MS;
+            else if (damaged != NULL && visible)
+                timeout = keep_ms;
+            ready = poll(fds, 3, timeout);
+            if (ready == -1 && errno == EINTR)
+                continue;
+            if (ready == -1)
+                break;
+        }
+
+        if (ready == 0 && !relayout_pending) {
+            char* screen = pages != NULL && fb_pages_front(pages) != NULL ? fb_pages_front(pages) : fb_ptr;
+            repair_placement(info, place, screen, damaged);
+            continue;
+        }
+
+        if (ready == 0) {
+            // events settled, find out where image should be now
+            int changed = tmux_changed;
+            if (resized)
+                changed |= update_term_size(info);
+            visible = 1;
+            relayout_pending = 0;
+            resized = 0;
+            tmux_changed = 0;
+
+            if (has_tmux) {
+                tmux_pane_state state;
+                if (tmux_control_pane_state(&ctl, &state) == -1)
+                    break;
+                relayout_pending = ctl.pending;
+                ctl.pending = 0;
+                memcpy(info->tty_offset, state.offset, sizeof(state.offset));
+                memcpy(info->terminal_size, state.size, sizeof(state.size));
+                visible = state.visible;
+            }
+            if (relayout_pending) {
+                // more events came meanwhile, change is drawn once they settle too
+                tmux_changed = changed;
+                continue;
+            }
+
+            if (changed) {
+                clip_placement(info, place);
+                if (damaged != NULL || pages != NULL) {
+                    shadow_placement(info, place, fb_ptr, 0);
+                    render_placement(info, place);
+                }
+            }
+            if (visible && changed)
+                present_placement(info, place, fb_ptr, pages);
+            continue;
+        }
+
+        if (fds[0].revents & (POLLIN|POLLHUP)) {
+            char key;
+            if (read(STDIN_FILENO, &key, 1) <= 0 || key == 'q')
+                break;
+        }
+        if (fds[2].revents & POLLIN) {
+            char drain[16];
+            while (read(winch_pipe[0], drain, sizeof(drain)) > 0);
+            relayout_pending = 1;
+            resized = 1;
+        }
+        if (has_tmux && (tmux_control_buffered(&ctl) || fds[1].revents & (POLLIN|POLLHUP))) {
+            char line[512];
+            int ret = tmux_control_read(&ctl, line, sizeof(line));
+            if (ret == -1)
+                break;
+            if (ret == 1)
+                relayout_pending = tmux_changed = 1;
+        }
+    }
+
+    free(damaged);
+    if (has_tty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &oldtty);
+    if (has_tmux)
+        tmux_control_close(&ctl);
+    signal(SIGWINCH, SIG_DFL);
+    if (winch_pipe[0] != -1) {
+        close(winch_pipe[0]);
+        close(winch_pipe[1]);
+    }
 }
 
+
+/**
+ * Options applied to every image drawn.
+ */
+typedef struct {
+    cursor_mode mode;
+    int background;
+    int crop[4];            // whole image when width is -1
+    int scroll[2];
+    const char* save_id;
+    int follow;
+    int keep_ms;
+    int vsync;
+    size_t max_mem;         // most memory decoder may take, 0 for no limit
+} image_options;
+
+/**
+ * Load image from *img_path* and draw it at cursor. Returns exit status.
+ */
+int show_image(const char* img_path, const image_options* opts, term_info* tinfo, int fbfd, char* fb_ptr) {
+    // file is mapped, so header, EXIF and decoder all read the same single copy
+    int span = stats_begin(&stats, "file");
+    size_t file_size;
+    unsigned char* file = map_file(img_path, &file_size);
+    if (file == NULL) {
+        fprintf(stderr, "Error: image %s couldn't be loaded: %s\n", img_path, strerror(errno));
+        stats_end(&stats, span, 0);
+        return 1;
+    }
+    stats_end(&stats, span, file_size);
+    span = stats_begin(&stats, "decode");
+    int width, height, channels;
+    int req_channels = 3;
+    int exif = FB_ROTATE_UR;
+    unsigned char *data;
+    fb_raw raw;
+    int is_raw = fb_raw_parse(file, file_size, &raw) == 0;
+    // its pixels were quantized and dithered for that format, in other one they'd be dithered twice
+    if (is_raw && !fb_raw_matches(&raw, &tinfo->format)) {
+        fprintf(stderr, "Error: raw image %s is in other pixel format than framebuffer, convert source image again\n",
+                img_path);
+        munmap(file, file_size);
+        stats_end(&stats, span, 0);
+        return 1;
+    }
+    // raw image is copied from file as it is
+    int direct = is_raw && tinfo->rotation == FB_ROTATE_UR
+                 && opts->crop[2] == -1 && opts->scroll[0] == 0 && opts->scroll[1] == 0
+                 && !opts->follow && opts->keep_ms == 0 && opts->save_id == NULL;
+    if (is_raw) {
+        width = raw.width;
+        height = raw.height;
+        // unpacked pixels are freed with decoded ones by stbi_image_free, they are
+        // drawn without dithering, which gives back the same pixels
+        data = direct ? (unsigned char*) raw.pixels : fb_arena_alloc((size_t) width * height * 3);
+        if (data != NULL && !direct)
+            fb_raw_to_rgb(&raw, data);
+    } else {
+        // images with alpha are kept with 4 channels and blended
+        int known = image_info(file, file_size, &width, &height, &channels);
+        if (known && (channels == 2 || channels == 4))
+            req_channels = 4;
+        // huge image is refused from its header, before decoder takes any memory
+        size_t needed = known ? decode_memory(file, file_size, width, height, channels, req_channels) : 0;
+        if (opts->max_mem > 0 && needed > opts->max_mem) {
+            fprintf(stderr, "Error: image %s (%dx%d) needs about %zu MiB to decode, more than --max-mem allows\n",
+                    img_path, width, height, (needed >> 20) + 1);
+            munmap(file, file_size);
+            stats_end(&stats, span, 0);
+            return 1;
+        }
+        data = decode_image(file, file_size, &width, &height, &channels, req_channels);
+        exif = fb_rotate_from_exif(exif_orientation(file, file_size));
+    }
+    if (!direct)
+        munmap(file, file_size);
+    stats_end(&stats, span, data != NULL && !direct ? (long) width * height * req_channels : 0);
+
+    if (data == NULL) {
+        fprintf(stderr, "Error: image %s couldn't be loaded: ", img_path);
+        fprintf(stderr, "%s\n", is_raw ? strerror(ENOMEM) : decode_failure_reason());
+        return 1;
+    }
+    // pixels stay as decoded, EXIF orientation is applied while drawing
+    int data_size[2] = {width, height};
+    if (fb_rotate_is_sideways(exif)) {
+        width = data_size[1];
+        height = data_size[0];
+    }
+
+    // stb_image decodes whole image, cut it before any work on pixels
+    span = stats_begin(&stats, "crop");
+    int crop[4] = {opts->crop[0], opts->crop[1], opts->crop[2], opts->crop[3]};
+    if (crop[2] == -1) {
+        crop[2] = width;
+        crop[3] = height;
+    }
+    if (!direct && crop_image(data, data_size, req_channels, exif, crop, opts->scroll, tinfo->cell_size,
+                              &width, &height) == -1) {
+        fprintf(stderr, "Error: Crop is outside of image.\n");
+        stbi_image_free(data);
+        stats_end(&stats, span, 0);
+        return 1;
+    }
+
+    // blending works on xrgb8888 only, other formats get image flattened
+    if (req_channels == 4 && !is_xrgb8888(&tinfo->format)) {
+        flatten_rgba(data, data_size[0], data_size[1], opts->background >= 0 ? opts->background : 0);
+        req_channels = 3;
+    }
+    stats_end(&stats, span, direct ? 0 : (long) data_size[0] * data_size[1] * req_channels);
+
+    const int* cell_size = tinfo->cell_size;
+
+    int image_lines = ceil((double) height / cell_size[1]);
+    int image_cols = ceil((double) width / cell_size[0]);
+
+    int indent = 1;
+
+    cursor cursor;
+    span = stats_begin(&stats, "cursor query");
+    tcflush(STDIN_FILENO, TCIOFLUSH);
+    init_cursor(&cursor, opts->mode, indent, tinfo, image_lines, image_cols);
+    stats_end(&stats, span, 0);
+
+    placement place = {
+        .data = data, .data_size = {data_size[0], data_size[1]},
+        .orientation = fb_rotate_compose(exif, tinfo->rotation), .width = width, .height = height,
+        .channels = req_channels, .line_length = direct ? raw.line_length : data_size[0] * req_channels,
+        .background = opts->background,
+        .pos = {cursor.begin_pos[0], cursor.begin_pos[1]}, .indent = indent
+    };
+    clip_placement(tinfo, &place);
+    int height_exceed = place.exceed[1];
+    int width_exceed = place.exceed[0];
+
+    span = stats_begin(&stats, "draw");
+    if (req_channels == 4)
+        premultiply_rgba(data, place.line_length, data_size[0], data_size[1]);
+
+    int persistent = opts->follow || opts->keep_ms > 0;
+    dither_mode dither = tinfo->dither;
+    if (is_raw)
+        tinfo->dither = DITHER_NONE;
+    // with vsync first frame already goes to page visible at current yoffset
+    fb_pages pages;
+    int use_pages = persistent && opts->vsync;
+    char* screen = fb_ptr;
+    if (use_pages) {
+        fb_pages_init(&pages, fbfd, STDIN_FILENO, tinfo->line_length, tinfo->ypanstep, tinfo->can_vsync, 1);
+        if (fb_pages_front(&pages) != NULL)
+            screen = fb_pages_front(&pages);
+    }
+    if (opts->keep_ms > 0 || opts->save_id != NULL || use_pages)
+        shadow_placement(tinfo, &place, screen, opts->save_id != NULL);
+    if (opts->save_id != NULL && save_placement_under(&place, opts->save_id) == -1)
+        fprintf(stderr, "Error: couldn't save region under image as '%s'\n", opts->save_id);
+    render_placement(tinfo, &place);
+
+    // TODO fix image being overwritten by character created by cursor after newline
+    if (direct)
+        copy_placement(tinfo, &place, screen);
+    else
+        draw_placement(tinfo, &place, screen);
+    if (opts->keep_ms == 0 && !use_pages)
+        shadow_fb_free(&place.shadow);
+    long drawn = place.visible_size[0] > 0 && place.visible_size[1] > 0
+               ? (long) place.visible_size[0] * place.visible_size[1] * tinfo->format.bytes_per_pixel : 0;
+    stats_end(&stats, span, drawn);
+
+    span = stats_begin(&stats, "cursor restore");
+    int image_bottom_pos = fmin(place.pos[1] + image_lines, tinfo->terminal_size[1]-2);
+    set_cursor_pos((int[]){0, image_bottom_pos});
+    
+    if (height_exceed > 0 && width_exceed > 0)
+        printf("%d line(s) and %d column(s) exceed", height_exceed, width_exceed);
+    else if (height_exceed > 0)     printf("%d line(s) exceed", height_exceed);
+    else if (width_exceed > 0)      printf("%d column(s) exceed", width_exceed); 
+    fflush(stdout);
+
+    set_cursor_pos(cursor.end_pos);
+    stats_end(&stats, span, 0);
+
+    if (persistent)
+        follow_placement(tinfo, &place, screen, opts->keep_ms, use_pages ? &pages : NULL);
+    if (use_pages)
+        fb_pages_release(&pages);
+    shadow_fb_free(&place.shadow);
+    if (direct)
+        munmap(file, file_size);
+    else
+        stbi_image_free(data);
+    tinfo->dither = dither;
+    return 0;
+}
+
+
+// benchmarks include this file for its drawing functions and have their own main
+#ifndef FBTTY_NO_MAIN
 int main(int argc, char *argv[]) {
+    // options aren't known yet, parsing is measured anyway and dropped if not asked for
+    stats_init(&stats, 1);
+    int span = stats_begin(&stats, "args");
+
     // handle arguments
-    const char *img_path = NULL;
     const char *out_path = "/dev/fb0";
     cursor_mode mode = END_AT_BOTTOM;
+    int use_cache = 1;
+    int follow = 0;
+    int keep_ms = 0;
+    const char *save_id = NULL;
+    const char *clear_id = NULL;
+    int background = -1;
+    int vsync = 0;
+    dither_mode dither = DITHER_ORDERED;
+    int set_palette = 0;
+    int crop[4] = {0, 0, -1, -1};   // whole image when width is -1
+    int scroll[2] = {0, 0};
+    int has_out_path = 0;
+    fb_virtual virt_fb;
+    const fb_virtual* virt = NULL;
+    const char *dump_path = NULL;
+    int show_stats = 0;     // 2 adds hardware counters
+    const char *trace_path = NULL;
+    int calibrate = 0;
+    int huge_pages = 0;
+    size_t max_mem = 0;
+    convert_kind convert = CONVERT_NONE;
   
-    const char *optstring = ":ho:vbft";
+    const char *optstring = ":hB:Fk::ns:c:o:vVd:PC:S:X:D:T::R:AHM:E:bft";
     struct option options[] = {
         {"help",    0, NULL, 'h'},
+        {"background", 1, NULL, 'B'},
+        {"follow",  0, NULL, 'F'},
+        {"keep",    2, NULL, 'k'},
+        {"save-under", 1, NULL, 's'},
+        {"clear",   1, NULL, 'c'},
+        {"no-cache", 0, NULL, 'n'},
         {"output",  1, NULL, 'o'},
         {"version", 0, NULL, 'v'},
+        {"vsync",   0, NULL, 'V'},
+        {"dither",  1, NULL, 'd'},
+        {"set-palette", 0, NULL, 'P'},
+        {"crop",    1, NULL, 'C'},
+        {"scroll",  1, NULL, 'S'},
+        {"virtual-fb", 1, NULL, 'X'},
+        {"dump",    1, NULL, 'D'},
+        {"stats",   2, NULL, 'T'},
+        {"trace",   1, NULL, 'R'},
+        {"calibrate", 0, NULL, 'A'},
+        {"huge-pages", 0, NULL, 'H'},
+        {"max-mem", 1, NULL, 'M'},
+        {"convert", 1, NULL, 'E'},
         {"bottom",  0, NULL, 'b'},
         {"flow",    0, NULL, 'f'},
         {"top",     0, NULL, 't'},
@@ -150,13 +1767,123 @@ int main(int argc, char *argv[]) {
                 printf(usage_note);
                 exit(0);
                 break;
+            case 'B': {
+                // exactly RRGGBB, strtol alone would take sign, spaces and 0x
+                const char* hex = optarg + (optarg[0] == '#');
+                int digits = strspn(hex, "0123456789abcdefABCDEF");
+                background = strtol(hex, NULL, 16);
+                if (digits != 6 || hex[digits] != '\0') {
+                    fprintf(stderr, "Error: Invalid background color '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+            case 'F':
+                follow = 1;
+                break;
+            case 'k':
+                keep_ms = optarg != NULL ? atoi(optarg) : 250;
+                if (keep_ms <= 0) {
+                    fprintf(stderr, "Error: Invalid keep interval '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'n':
+                use_cache = 0;
+                break;
+            case 's':
+                save_id = optarg;
+                break;
+            case 'c':
+                clear_id = optarg;
+                break;
             case 'o':
                 out_path = optarg;
+                has_out_path = 1;
                 break;
             case 'v':
                 printf("fbtty %s\n", VERSION);
                 exit(0);
                 break;
+            case 'V':
+                vsync = 1;
+                break;
+            case 'd':
+                if (strcmp(optarg, "ordered") == 0)
+                    dither = DITHER_ORDERED;
+                else if (strcmp(optarg, "fs") == 0)
+                    dither = DITHER_FS;
+                else if (strcmp(optarg, "none") == 0)
+                    dither = DITHER_NONE;
+                else {
+                    fprintf(stderr, "Error: Unknown dither mode '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'P':
+                set_palette = 1;
+                break;
+            case 'C': {
+                int end = 0;
+                if (sscanf(optarg, "%d,%d,%d,%d%n", &crop[0], &crop[1], &crop[2], &crop[3], &end) != 4
+                        || optarg[end] != '\0' || crop[0] < 0 || crop[1] < 0 || crop[2] <= 0 || crop[3] <= 0) {
+                    fprintf(stderr, "Error: Invalid crop '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+            case 'S': {
+                int end = 0;
+                if (sscanf(optarg, "%d,%d%n", &scroll[0], &scroll[1], &end) != 2 || optarg[end] != '\0') {
+                    fprintf(stderr, "Error: Invalid scroll offset '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+            case 'X':
+                if (fb_virtual_parse(optarg, &virt_fb) == -1) {
+                    fprintf(stderr, "Error: Invalid virtual framebuffer '%s', expected <W>x<H>[:<fmt>] with <fmt> one of %s.\n",
+                            optarg, fb_virtual_formats);
+                    exit(1);
+                }
+                virt = &virt_fb;
+                break;
+            case 'D':
+                dump_path = optarg;
+                break;
+            case 'T':
+                if (optarg != NULL && strcmp(optarg, "hw") != 0) {
+                    fprintf(stderr, "Error: Unknown stats kind '%s'.\n", optarg);
+                    exit(1);
+                }
+                show_stats = optarg != NULL ? 2 : 1;
+                break;
+            case 'R':
+                trace_path = optarg;
+                break;
+            case 'A':
+                calibrate = 1;
+                break;
+            case 'H':
+                huge_pages = 1;
+                break;
+            case 'E':
+                if (strcmp(optarg, "raw") == 0)
+                    convert = CONVERT_RAW;
+                else if (strcmp(optarg, "qoi") == 0)
+                    convert = CONVERT_QOI;
+                else {
+                    fprintf(stderr, "Error: Unknown conversion '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'M':
+                max_mem = parse_size(optarg);
+                if (max_mem == 0) {
+                    fprintf(stderr, "Error: Invalid memory size '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
             case 'b': 
                 mode = END_AT_BOTTOM;
                 break;
@@ -176,92 +1903,128 @@ int main(int argc, char *argv[]) {
         }  
     }
 
-    // get input image path
+    if (convert != CONVERT_NONE) {
+        if (!has_out_path || argc - optind != 1) {
+            fprintf(stderr, "Error: --convert takes one image and output path (-o).\n");
+            return 1;
+        }
+        return convert_file(argv[optind], out_path, convert, "/dev/fb0", virt, dither, background);
+    }
+
+    if (clear_id != NULL) {
+        // fresh framebuffer in memory has nothing to restore
+        if (virt != NULL && !has_out_path) {
+            fprintf(stderr, "Error: --clear with --virtual-fb needs file of framebuffer (-o).\n");
+            return 1;
+        }
+        return clear_saved_region(out_path, virt, clear_id);
+    }
+
+    // without -o virtual framebuffer lives in memory only
+    if (virt != NULL && !has_out_path)
+        out_path = "virtual";
+
+    if (calibrate)
+        return calibrate_blit(out_path, virt, has_out_path, use_cache);
+
+    // get input image paths
     if (argc <= optind) {
         fprintf(stderr, "Error: Image path was not provided.\n");
         fprintf(stderr, usage_note);
         return 1;
     }
-    img_path = argv[optind];
-    //
-
-    // load image and framebuffer
-    int width, height, channels;
-    unsigned char *data = stbi_load(img_path, &width, &height, &channels, 3);
-
-    if (data == NULL) {
-        fprintf(stderr, "Error: image %s couldn't be loaded: ", img_path);
-        fprintf(stderr, "%s\n", stbi_failure_reason());
+    if (argc - optind > 1 && (follow || keep_ms > 0 || save_id != NULL)) {
+        fprintf(stderr, "Error: --follow, --keep and --save-under take one image.\n");
         return 1;
     }
+    stats_end(&stats, span, 0);
+    stats.enabled = show_stats || trace_path != NULL;
+    if (show_stats == 2 && stats_enable_hw(&stats) == -1)
+        fprintf(stderr, "Warning: hardware counters unavailable, stages are timed only: %s\n", strerror(errno));
+    // decoder memory is kept and reused by next images
+    fb_arena_init(huge_pages);
+    fb_arena_set_limit(max_mem);
+    //
 
-    int fbfd = open(out_path, O_RDWR);
+    // load framebuffer
+    span = stats_begin(&stats, "framebuffer info");
+    int fbfd = virt != NULL ? fb_virtual_open(has_out_path ? out_path : NULL, virt) : open(out_path, O_RDWR);
    
     if (fbfd == -1) {
         fprintf(stderr, "Error: output device %s not found\n", out_path);
-        stbi_image_free(data);
         return 1;
     }
 
-    term_info tinfo; init_term_info(fbfd, &tinfo);
+    term_info tinfo;
+    int status = init_term_info(fbfd, virt, out_path, use_cache, vsync, &tinfo);
+    if (status == -2)
+        fprintf(stderr, "Error: pixel format of %s is not supported\n", out_path);
+    else if (status == -1)
+        fprintf(stderr, "Error: %s is not a framebuffer device, use --virtual-fb for plain files\n", out_path);
+    if (status < 0) {
+        close(fbfd);
+        return 1;
+    }
+    tinfo.dither = dither;
+    stats_end(&stats, span, 0);
 
+    // pixels of palette framebuffers are indices of nearest palette colors
+    fb_palette* palette = NULL;
+    if (tinfo.visual == FB_VISUAL_PSEUDOCOLOR || tinfo.visual == FB_VISUAL_STATIC_PSEUDOCOLOR) {
+        span = stats_begin(&stats, "palette");
+        if (tinfo.format.bytes_per_pixel == 1)
+            palette = init_palette(fbfd, virt, &tinfo, set_palette);
+        if (palette == NULL) {
+            fprintf(stderr, "Error: palette of %s couldn't be used\n", out_path);
+            close(fbfd);
+            return 1;
+        }
+        stats_end(&stats, span, 0);
+    }
+
+    span = stats_begin(&stats, "mmap");
     char* fb_ptr = (char*) mmap(0, tinfo.screen_size, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);    
     
     if ((long) fb_ptr == -1) {
         fprintf(stderr, "Error: failed to map framebuffer\n");
         fprintf(stderr, "mmap: %s\n", strerror(errno));
-        stbi_image_free(data);
+        free(palette);
         close(fbfd);
         return 1;
     }
+    stats_end(&stats, span, 0);
     //
 
+    // images are drawn one after another, failed one doesn't stop the rest
+    image_options opts = {
+        mode, background, {crop[0], crop[1], crop[2], crop[3]}, {scroll[0], scroll[1]},
+        save_id, follow, keep_ms, vsync, max_mem
+    };
+    int ret = 0;
+    for (int i = optind; i < argc; i++)
+        ret |= show_image(argv[i], &opts, &tinfo, fbfd, fb_ptr);
 
-    int cell_size[2];
-    get_cell_size(cell_size);
-
-    int image_lines = ceil((double) height / cell_size[1]);
-    int image_cols = ceil((double) width / cell_size[0]);
-
-    int indent = 1;
-
-    cursor cursor;
-    tcflush(STDIN_FILENO, TCIOFLUSH);
-    init_cursor(&cursor, mode, indent, cell_size, image_lines, image_cols);
-
-    int image_end_pos[2];
-    int img_line_length = width * 3;
-
-    // calculate height exceed
-    image_end_pos[1] = cursor.begin_pos[1] + image_lines;
-    int height_exceed = image_end_pos[1] - tinfo.terminal_size[1]; 
-    if (height_exceed > 0) 
-        height -= (height_exceed+1)*cell_size[1];
-    
-    // calculate width exceed
-    image_end_pos[0] = cursor.begin_pos[0] + indent + image_cols;
-    int width_exceed = image_end_pos[0] - tinfo.terminal_size[0];
-    if (width_exceed > 0) {
-        width -= width_exceed*cell_size[0];
+    if (dump_path != NULL) {
+        span = stats_begin(&stats, "dump");
+        if (fb_dump(dump_path, (const unsigned char*) fb_ptr, tinfo.screen_size, tinfo.line_length,
+                    tinfo.resolution[0], tinfo.resolution[1], &tinfo.format) == -1) {
+            fprintf(stderr, "Error: framebuffer couldn't be saved to %s\n", dump_path);
+            ret = 1;
+        }
+        stats_end(&stats, span, 0);
     }
-
-    // TODO fix image being overwritten by character created by cursor after newline
-    write_image(cursor.begin_pos_px, width, height, img_line_length, tinfo.line_length, data, fb_ptr);
-    
-    int image_bottom_pos = fmin(image_end_pos[1], tinfo.terminal_size[1]-2);
-    set_cursor_pos((int[]){0, image_bottom_pos});
-    
-    if (height_exceed > 0 && width_exceed > 0)
-        printf("%d line(s) and %d column(s) exceed", height_exceed, width_exceed);
-    else if (height_exceed > 0)     printf("%d line(s) exceed", height_exceed);
-    else if (width_exceed > 0)      printf("%d column(s) exceed", width_exceed); 
-    fflush(stdout);
-
-    set_cursor_pos(cursor.end_pos);
+    if (show_stats)
+        stats_print(&stats, stderr);
+    if (trace_path != NULL && stats_write_trace(&stats, trace_path) == -1) {
+        fprintf(stderr, "Error: trace couldn't be written to %s\n", trace_path);
+        ret = 1;
+    }
+    stats_free(&stats);
 
     munmap(fb_ptr, tinfo.screen_size);
     close(fbfd);
-    stbi_image_free(data);
+    free(palette);
 
-    return 0;
+    return ret;
 }
+#endif
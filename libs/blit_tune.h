@@ -0,0 +1,114 @@
+/* blit_tune - Saved choice of fastest way to write framebuffer
+ *
+ * Do this:
+ *   #define BLIT_TUNE_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Speed of writes differs a lot between drivers (write-combined VESA or
+ * EFI memory, DRM fbdev emulation with shadow buffer, virtio), so fbtty
+ * --calibrate times every strategy and thread count on the device and
+ * keeps the winner in user's cache directory, one file per framebuffer id
+ * and geometry, where later runs find it.
+ */
+
+#ifndef BLIT_TUNE_H
+#define BLIT_TUNE_H
+
+#define BLIT_MAX_THREADS 16
+
+typedef enum {
+    BLIT_STREAM,    // convert into band in cache, copy rows with non-temporal stores
+    BLIT_STORE,     // convert straight into framebuffer with plain stores
+    BLIT_MEMCPY,    // convert into band in cache, memcpy rows
+    BLIT_PWRITE,    // convert into band in cache, pwrite rows to device
+    BLIT_STRATEGIES
+} blit_strategy;
+
+typedef struct {
+    blit_strategy strategy;
+    int threads;            // number of threads converting and writing bands
+} blit_choice;
+
+extern const char* const blit_strategy_names[BLIT_STRATEGIES];
+
+// Put path of saved choice for framebuffer *id* of *width* x *height*
+// pixels of *bits_per_pixel* into *path*. Returns 0 on success.
+int blit_choice_path(const char* id, int width, int height, int bits_per_pixel, char* path, int len);
+
+// Read choice from *path*. Returns 0 on success, -1 if missing or invalid.
+int blit_choice_load(const char* path, blit_choice* choice);
+
+// Write choice to *path*, creating directory. Returns 0 on success.
+int blit_choice_store(const char* path, const blit_choice* choice);
+
+#endif
+
+#ifdef BLIT_TUNE_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>   // getenv
+#include <string.h>
+#include <unistd.h>   // access
+#include <sys/stat.h> // mkdir
+
+const char* const blit_strategy_names[BLIT_STRATEGIES] = {"stream", "store", "memcpy", "pwrite"};
+
+// Get directory for saved choices, created if needed
+static int blit_choice_dir(char* dir, int len) {
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (cache != NULL && cache[0] == '/')
+        snprintf(dir, len, "%s", cache);
+    else if (home != NULL)
+        snprintf(dir, len, "%s/.cache", home);
+    else
+        return -1;
+    mkdir(dir, 0700);
+    size_t used = strlen(dir);
+    snprintf(dir + used, len - used, "/fbtty");
+    if (mkdir(dir, 0700) == -1 && access(dir, W_OK) == -1)
+        return -1;
+    return 0;
+}
+
+int blit_choice_path(const char* id, int width, int height, int bits_per_pixel, char* path, int len) {
+    char dir[256];
+    if (blit_choice_dir(dir, sizeof(dir)) == -1)
+        return -1;
+    // driver id may have spaces and slashes
+    char name[32];
+    snprintf(name, sizeof(name), "%s", id);
+    for (char* c = name; *c; c++)
+        if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9')))
+            *c = '_';
+    snprintf(path, len, "%s/blit-%s-%dx%d-%d", dir, name, width, height, bits_per_pixel);
+    return 0;
+}
+
+int blit_choice_load(const char* path, blit_choice* choice) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    char name[16];
+    int threads;
+    int parsed = fscanf(file, "%15s %d", name, &threads);
+    fclose(file);
+    if (parsed != 2 || threads < 1 || threads > BLIT_MAX_THREADS)
+        return -1;
+    for (int i = 0; i < BLIT_STRATEGIES; i++)
+        if (strcmp(name, blit_strategy_names[i]) == 0) {
+            choice->strategy = i;
+            choice->threads = threads;
+            return 0;
+        }
+    return -1;
+}
+
+int blit_choice_store(const char* path, const blit_choice* choice) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+    fprintf(file, "%s %d\n", blit_strategy_names[choice->strategy], choice->threads);
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/* exif_orient - Orientation tag of JPEG image
+ *
+ * Do this:
+ *   #define EXIF_ORIENT_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Cameras store pixels as sensor saw them and put into EXIF (APP1 segment)
+ * how image has to be turned to be shown upright. Only markers before
+ * image data are looked at, everything else in file is skipped.
+ */
+
+#ifndef EXIF_ORIENT_H
+#define EXIF_ORIENT_H
+
+// Get EXIF Orientation (1..8) of JPEG file in *len* bytes at *file*,
+// 1 (upright) when file isn't JPEG or doesn't have the tag.
+int exif_orientation(const unsigned char* file, long len);
+
+#endif
+
+#ifdef EXIF_ORIENT_IMPLEMENTATION
+#include <string.h>
+
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TYPE_SHORT 3
+
+static unsigned int exif_read16(const unsigned char* p, int big_endian) {
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static unsigned int exif_read32(const unsigned char* p, int big_endian) {
+    return big_endian ? exif_read16(p, 1) << 16 | exif_read16(p + 2, 1)
+                      : exif_read16(p + 2, 0) << 16 | exif_read16(p, 0);
+}
+
+// Find orientation in APP1 segment *data* of *len* bytes, 0 if it's not there
+static int exif_parse(const unsigned char* data, long len) {
+    if (len < 14 || memcmp(data, "Exif\0\0", 6) != 0)
+        return 0;
+    // offsets are relative to TIFF header following "Exif\0\0"
+    const unsigned char* tiff = data + 6;
+    long tiff_len = len - 6;
+    int big_endian = tiff[0] == 'M';
+    if ((tiff[0] != 'M' && tiff[0] != 'I') || tiff[1] != tiff[0] || exif_read16(tiff + 2, big_endian) != 42)
+        return 0;
+
+    unsigned long ifd = exif_read32(tiff + 4, big_endian);
+    if (ifd + 2 > (unsigned long) tiff_len)
+        return 0;
+    int count = exif_read16(tiff + ifd, big_endian);
+    for (int i = 0; i < count; i++) {
+        unsigned long entry = ifd + 2 + 12 * i;
+        if (entry + 12 > (unsigned long) tiff_len)
+            return 0;
+        if (exif_read16(tiff + entry, big_endian) != EXIF_TAG_ORIENTATION)
+            continue;
+        if (exif_read16(tiff + entry + 2, big_endian) != EXIF_TYPE_SHORT)
+            return 0;
+        int orientation = exif_read16(tiff + entry + 8, big_endian);
+        return orientation >= 1 && orientation <= 8 ? orientation : 0;
+    }
+    return 0;
+}
+
+int exif_orientation(const unsigned char* file, long len) {
+    if (len < 4 || file[0] != 0xFF || file[1] != 0xD8)
+        return 1;
+    long pos = 2;
+    while (pos + 4 <= len && file[pos] == 0xFF) {
+        int marker = file[pos+1];
+        if (marker == 0xFF) {   // fill byte
+            pos++;
+            continue;
+        }
+        // image data starts
+        if (marker == 0xDA || marker == 0xD9)
+            break;
+        long segment_len = (file[pos+2] << 8 | file[pos+3]) - 2;
+        pos += 4;
+        if (segment_len < 0 || pos + segment_len > len)
+            break;
+        if (marker == 0xE1) {
+            int orientation = exif_parse(file + pos, segment_len);
+            if (orientation != 0)
+                return orientation;
+        }
+        pos += segment_len;
+    }
+    return 1;
+}
+
+#endif
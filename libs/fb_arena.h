@@ -0,0 +1,154 @@
+/* fb_arena - Reusable memory for image decoder
+ *
+ * Do this:
+ *   #define FB_ARENA_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Made to be plugged into stb_image as STBI_MALLOC, STBI_REALLOC and
+ * STBI_FREE. Sizes are rounded up to classes, four per power of two (at
+ * most a quarter is wasted), and freed blocks are kept on list of their
+ * class instead of being given back to system. Next image of similar size
+ * gets blocks whose pages are already mapped, so decoding it causes no page
+ * faults and no mmap/munmap calls. Blocks of FB_ARENA_MAP_MIN bytes and
+ * more are mapped directly and can be backed by transparent huge pages.
+ * Memory is held until exit, or until limit set by fb_arena_set_limit
+ * would be crossed: then kept blocks are given back first and allocation
+ * fails only if it still doesn't fit, so decoder reports out of memory
+ * instead of process being killed. Not thread safe, stb_image decodes on
+ * one thread.
+ */
+
+#ifndef FB_ARENA_H
+#define FB_ARENA_H
+
+#include <stddef.h>
+
+// Blocks at least this big are mapped, not taken from malloc
+#define FB_ARENA_MAP_MIN (128 * 1024)
+
+// Use transparent huge pages for mapped blocks of 2 MiB and more when *huge_pages* is set
+void fb_arena_init(int huge_pages);
+
+// Fail allocations which would make arena hold more than *limit* bytes, 0 for no limit
+void fb_arena_set_limit(size_t limit);
+
+void* fb_arena_alloc(size_t size);
+void* fb_arena_realloc(void* ptr, size_t size);
+void fb_arena_free(void* ptr);
+
+#endif
+
+#ifdef FB_ARENA_IMPLEMENTATION
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// 64 bytes to 7 * 2^40 bytes
+#define FB_ARENA_CLASSES 148
+// Keeps payload 16-byte aligned, holds class of block
+#define FB_ARENA_HEADER 16
+#define FB_ARENA_HUGE_PAGE (2 * 1024 * 1024)
+
+static struct {
+    int huge_pages;
+    size_t limit;
+    size_t held;                    // bytes of all blocks, used and kept
+    void* free[FB_ARENA_CLASSES];   // freed blocks, linked through their payload
+} fb_arena;
+
+// Size of blocks of *size_class*, header included
+static size_t fb_arena_class_size(int size_class) {
+    return (size_t) (4 + (size_class & 3)) << ((size_class >> 2) + 4);
+}
+
+// Smallest class holding *size* bytes with header, -1 if too big
+static int fb_arena_class(size_t size) {
+    for (int c = 0; c < FB_ARENA_CLASSES; c++)
+        if (fb_arena_class_size(c) - FB_ARENA_HEADER >= size)
+            return c;
+    return -1;
+}
+
+void fb_arena_init(int huge_pages) {
+    fb_arena.huge_pages = huge_pages;
+}
+
+void fb_arena_set_limit(size_t limit) {
+    fb_arena.limit = limit;
+}
+
+static void fb_arena_release_block(unsigned char* block, size_t block_size) {
+    if (block_size >= FB_ARENA_MAP_MIN)
+        munmap(block, block_size);
+    else
+        free(block);
+    fb_arena.held -= block_size;
+}
+
+// Give kept blocks back to system until *size* more bytes fit in limit
+static int fb_arena_make_room(size_t size) {
+    for (int c = FB_ARENA_CLASSES - 1; c >= 0 && fb_arena.held + size > fb_arena.limit; c--)
+        while (fb_arena.free[c] != NULL && fb_arena.held + size > fb_arena.limit) {
+            unsigned char* block = fb_arena.free[c];
+            memcpy(&fb_arena.free[c], block + FB_ARENA_HEADER, sizeof(void*));
+            fb_arena_release_block(block, fb_arena_class_size(c));
+        }
+    return fb_arena.held + size <= fb_arena.limit ? 0 : -1;
+}
+
+void* fb_arena_alloc(size_t size) {
+    int size_class = fb_arena_class(size);
+    if (size_class == -1)
+        return NULL;
+    unsigned char* block = fb_arena.free[size_class];
+    if (block != NULL) {
+        memcpy(&fb_arena.free[size_class], block + FB_ARENA_HEADER, sizeof(void*));
+        return block + FB_ARENA_HEADER;
+    }
+
+    size_t block_size = fb_arena_class_size(size_class);
+    if (fb_arena.limit > 0 && fb_arena_make_room(block_size) == -1)
+        return NULL;
+    if (block_size >= FB_ARENA_MAP_MIN) {
+        block = mmap(NULL, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        if (fb_arena.huge_pages && block_size >= FB_ARENA_HUGE_PAGE)
+            madvise(block, block_size, MADV_HUGEPAGE);
+#endif
+    } else {
+        block = malloc(block_size);
+        if (block == NULL)
+            return NULL;
+    }
+    *(size_t*) block = size_class;
+    fb_arena.held += block_size;
+    return block + FB_ARENA_HEADER;
+}
+
+void* fb_arena_realloc(void* ptr, size_t size) {
+    if (ptr == NULL)
+        return fb_arena_alloc(size);
+    unsigned char* block = (unsigned char*) ptr - FB_ARENA_HEADER;
+    size_t old_size = fb_arena_class_size(*(size_t*) block) - FB_ARENA_HEADER;
+    if (size <= old_size)
+        return ptr;
+    void* moved = fb_arena_alloc(size);
+    if (moved == NULL)
+        return NULL;
+    memcpy(moved, ptr, old_size);
+    fb_arena_free(ptr);
+    return moved;
+}
+
+void fb_arena_free(void* ptr) {
+    if (ptr == NULL)
+        return;
+    unsigned char* block = (unsigned char*) ptr - FB_ARENA_HEADER;
+    size_t size_class = *(size_t*) block;
+    memcpy(block + FB_ARENA_HEADER, &fb_arena.free[size_class], sizeof(void*));
+    fb_arena.free[size_class] = block;
+}
+
+#endif
@@ -0,0 +1,420 @@
+/* fb_blit - Pixel conversion and copying between image and framebuffer
+ *
+ * Do this:
+ *   #define FB_BLIT_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Framebuffer pixels are 4 bytes: blue, green, red, unused (xrgb8888),
+ * other truecolor formats (channels of at most 8 bits) are supported by
+ * conversion only and get ordered (8x8 Bayer) dithering when a channel has
+ * less than 8 bits. Pseudocolor
+ * pixels are palette indices looked up in 32x32x32 table (see fb_palette.h).
+ * Images with alpha are kept as premultiplied BGRA, so blending a pixel
+ * is out = src + out * (255 - alpha) / 255 for each channel.
+ * SSE2 is used when compiler targets it (always on x86-64), scalar code
+ * rounds the same way so both give identical output.
+ */
+
+#ifndef FB_BLIT_H
+#define FB_BLIT_H
+
+typedef struct {
+    int bytes_per_pixel;
+    int offset[3];          // bit offset of red, green and blue in pixel
+    int length[3];          // bits of red, green and blue
+    const unsigned char* palette;       // RGB of palette entries, NULL for truecolor
+    const unsigned char* palette_lut;   // nearest entry at (r>>3)<<10 | (g>>3)<<5 | b>>3
+} fb_format;
+
+// Check if *format* is 4 bytes blue, green, red, unused
+int is_xrgb8888(const fb_format* format);
+
+// Convert *width* x *height* RGB image into framebuffer pixels in *out*.
+// *phase* is position of *out* on screen, dither pattern is aligned to screen
+// so redrawn parts match. With NULL *phase* colors are truncated, not dithered.
+// Pseudocolor pixels get nearest palette entry without dithering.
+void convert_rgb_rows(const unsigned char* data, int img_line_length, int width, int height,
+                      unsigned char* out, int out_line_length, const fb_format* format, const int* phase);
+
+// Blend RGBA image over 0xRRGGBB *color*, in place, into RGB image
+// with *width* * 3 bytes per line.
+void flatten_rgba(unsigned char* data, int width, int height, unsigned int color);
+
+// Convert RGBA image in place into premultiplied BGRA.
+void premultiply_rgba(unsigned char* data, int img_line_length, int width, int height);
+
+// Blend premultiplied BGRA image over framebuffer pixels in *out*.
+// Groups of 4 pixels which are fully opaque are copied and fully transparent
+// are skipped. *spans* gets first and last+1 changed pixel of each row
+// (spans[y*2], spans[y*2+1]), both -1 for rows which are fully transparent.
+void composite_bgra_rows(const unsigned char* data, int img_line_length, int width, int height,
+                         unsigned char* out, int out_line_length, int* spans);
+
+// Fill *width* x *height* framebuffer pixels with 0xRRGGBB *color*.
+void fill_rows(unsigned char* out, int out_line_length, int width, int height, unsigned int color);
+
+// Copy *height* rows of *row_bytes* bytes from *src* to *dst*.
+void copy_rows(const unsigned char* src, int src_line_length,
+               unsigned char* dst, int dst_line_length, int row_bytes, int height);
+
+// Copy *len* bytes to framebuffer memory at *dst* with non-temporal
+// stores, so written pixels don't evict cache. Call store_fence after
+// last copy of a batch.
+void stream_copy(unsigned char* dst, const unsigned char* src, int len);
+void store_fence(void);
+
+// Compare rows of *screen* with *expected* and set damaged[y] to 1 for
+// rows which differ (0 otherwise). Returns number of damaged rows.
+// Each row is read with 16-byte loads, four per step, and scan of row
+// stops at first difference, so intact rows cost one pass of wide reads.
+int find_damaged_rows(const unsigned char* screen, int screen_line_length,
+                      const unsigned char* expected, int expected_line_length,
+                      int row_bytes, int height, unsigned char* damaged);
+
+#endif
+
+#ifdef FB_BLIT_IMPLEMENTATION
+#include <string.h> // memcpy, memcmp
+#include <stdint.h> // uintptr_t
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int is_xrgb8888(const fb_format* format) {
+    return format->bytes_per_pixel == 4
+        && format->offset[0] == 16 && format->offset[1] == 8 && format->offset[2] == 0
+        && format->length[0] == 8 && format->length[1] == 8 && format->length[2] == 8;
+}
+
+// 8x8 Bayer threshold matrix, values 0..63
+static const unsigned char bayer8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// Pack 8-bit channels into pixel of *format*
+static unsigned int pack_pixel(const unsigned char* rgb, const fb_format* format) {
+    unsigned int pixel = 0;
+    for (int c = 0; c < 3; c++)
+        pixel |= (unsigned int) (rgb[c] >> (8 - format->length[c])) << format->offset[c];
+    return pixel;
+}
+
+#ifdef __SSE2__
+// Shifts and masks moving each 8-bit channel to its bits in pixel
+typedef struct {
+    __m128i right[3], left[3], mask[3];
+} pixel_packer;
+
+static void packer_init(pixel_packer* packer, const fb_format* format) {
+    for (int c = 0; c < 3; c++) {
+        // channel c is byte c of 32-bit lane, its top length[c] bits are kept
+        int shift = c*8 + 8 - format->length[c] - format->offset[c];
+        packer->right[c] = _mm_cvtsi32_si128(shift > 0 ? shift : 0);
+        packer->left[c] = _mm_cvtsi32_si128(shift < 0 ? -shift : 0);
+        packer->mask[c] = _mm_set1_epi32(((1u << format->length[c]) - 1) << format->offset[c]);
+    }
+}
+
+// Pack 4 RGB pixels (12 bytes at *rgb*, 16 are read) into 32-bit lanes
+static __m128i pack_4px(const unsigned char* rgb, const pixel_packer* packer) {
+    // shifting vector left by k bytes puts bytes 3k..3k+3 into lane k
+    __m128i v = _mm_loadu_si128((const __m128i*) rgb);
+    __m128i lanes = _mm_and_si128(v, _mm_set_epi32(0, 0, 0, -1));
+    lanes = _mm_or_si128(lanes, _mm_and_si128(_mm_slli_si128(v, 1), _mm_set_epi32(0, 0, -1, 0)));
+    lanes = _mm_or_si128(lanes, _mm_and_si128(_mm_slli_si128(v, 2), _mm_set_epi32(0, -1, 0, 0)));
+    lanes = _mm_or_si128(lanes, _mm_and_si128(_mm_slli_si128(v, 3), _mm_set_epi32(-1, 0, 0, 0)));
+    __m128i pixel = _mm_setzero_si128();
+    for (int c = 0; c < 3; c++) {
+        __m128i channel = _mm_sll_epi32(_mm_srl_epi32(lanes, packer->right[c]), packer->left[c]);
+        pixel = _mm_or_si128(pixel, _mm_and_si128(channel, packer->mask[c]));
+    }
+    return pixel;
+}
+
+// Narrow 32-bit lanes holding 16-bit pixels, packs_epi32 saturates signed
+// values so lanes are sign-extended from 16 bits first
+static __m128i narrow_8px(__m128i lo, __m128i hi) {
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+#endif
+
+// Convert with ordered dithering, thresholds are added to interleaved RGB
+// bytes with saturation (16 pixels per 3 SSE2 adds). 16 and 32-bit pixels
+// are then packed 4 per SSE2 vector, 24-bit ones one by one.
+static void convert_rgb_rows_dither(const unsigned char* data, int img_line_length, int width, int height,
+                                    unsigned char* out, int out_line_length, const fb_format* format, const int* phase) {
+    // thresholds of one row for 16 pixels, repeating every 8 pixels
+    unsigned char thresholds[48] __attribute__((aligned(16)));
+    // packing reads 4 bytes past last pixel
+    unsigned char dithered[64] __attribute__((aligned(16))) = {0};
+    int bpp = format->bytes_per_pixel;
+    if (phase == NULL)
+        memset(thresholds, 0, sizeof(thresholds));
+#ifdef __SSE2__
+    pixel_packer packer;
+    packer_init(&packer, format);
+#endif
+
+    for (int y = 0; y < height; y++) {
+        if (phase != NULL) {
+            const unsigned char* bayer_row = bayer8[(y + phase[1]) & 7];
+            for (int x = 0; x < 16; x++)
+                for (int c = 0; c < 3; c++) {
+                    int step_bits = 8 - format->length[c];
+                    thresholds[x*3+c] = (bayer_row[(x + phase[0]) & 7] << step_bits) >> 6;
+                }
+        }
+
+        const unsigned char* src = data + y * img_line_length;
+        unsigned char* dst = out + y * out_line_length;
+        for (int x = 0; x < width; x += 16) {
+            int count = width - x < 16 ? width - x : 16;
+#ifdef __SSE2__
+            if (count == 16) {
+                for (int i = 0; i < 48; i += 16)
+                    _mm_store_si128((__m128i*) (dithered + i), _mm_adds_epu8(
+                        _mm_loadu_si128((const __m128i*) (src + x*3 + i)),
+                        _mm_load_si128((const __m128i*) (thresholds + i))));
+            } else
+#endif
+            for (int i = 0; i < count*3; i++) {
+                int v = src[x*3 + i] + thresholds[i];
+                dithered[i] = v > 255 ? 255 : v;
+            }
+
+            unsigned char* loc = dst + x * bpp;
+#ifdef __SSE2__
+            if (count == 16 && (bpp == 2 || bpp == 4)) {
+                for (int i = 0; i < 16; i += 8) {
+                    __m128i lo = pack_4px(dithered + i*3, &packer);
+                    __m128i hi = pack_4px(dithered + i*3 + 12, &packer);
+                    if (bpp == 2) {
+                        _mm_storeu_si128((__m128i*) (loc + i*2), narrow_8px(lo, hi));
+                    } else {
+                        _mm_storeu_si128((__m128i*) (loc + i*4), lo);
+                        _mm_storeu_si128((__m128i*) (loc + i*4 + 16), hi);
+                    }
+                }
+                continue;
+            }
+#endif
+            if (bpp == 2) {
+                for (int i = 0; i < count; i++) {
+                    unsigned short pixel = pack_pixel(dithered + i*3, format);
+                    memcpy(loc + i*2, &pixel, 2);
+                }
+            } else {
+                for (int i = 0; i < count; i++) {
+                    unsigned int pixel = pack_pixel(dithered + i*3, format);
+                    for (int b = 0; b < bpp; b++)
+                        loc[i*bpp + b] = pixel >> (b*8);
+                }
+            }
+        }
+    }
+}
+
+// Convert into 8-bit palette indices, one table load per pixel
+static void convert_rgb_rows_palette(const unsigned char* data, int img_line_length, int width, int height,
+                                     unsigned char* out, int out_line_length, const unsigned char* lut) {
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src = data + y * img_line_length;
+        unsigned char* dst = out + y * out_line_length;
+        for (int x = 0; x < width; x++, src += 3)
+            dst[x] = lut[(src[0] >> 3) << 10 | (src[1] >> 3) << 5 | src[2] >> 3];
+    }
+}
+
+void convert_rgb_rows(const unsigned char* data, int img_line_length, int width, int height,
+                      unsigned char* out, int out_line_length, const fb_format* format, const int* phase) {
+    if (format->palette_lut != NULL) {
+        convert_rgb_rows_palette(data, img_line_length, width, height, out, out_line_length, format->palette_lut);
+        return;
+    }
+    if (!is_xrgb8888(format)) {
+        convert_rgb_rows_dither(data, img_line_length, width, height, out, out_line_length, format, phase);
+        return;
+    }
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src = data + y * img_line_length;
+        unsigned char* dst = out + y * out_line_length;
+        for (int x = 0; x < width; x++) {
+            dst[x*4]   = src[x*3+2];
+            dst[x*4+1] = src[x*3+1];
+            dst[x*4+2] = src[x*3];
+            dst[x*4+3] = 0;
+        }
+    }
+}
+
+// x / 255 rounded, exact for x in [0, 255*255]
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+void flatten_rgba(unsigned char* data, int width, int height, unsigned int color) {
+    unsigned int back[3] = {(color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF};
+    for (long i = 0; i < (long) width * height; i++) {
+        unsigned char* src = data + i*4;
+        unsigned int a = src[3], inv = 255 - a;
+        for (int c = 0; c < 3; c++)
+            data[i*3+c] = DIV255(src[c] * a + back[c] * inv);
+    }
+}
+
+void premultiply_rgba(unsigned char* data, int img_line_length, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        unsigned char* pixel = data + y * img_line_length;
+        for (int x = 0; x < width; x++, pixel += 4) {
+            unsigned int r = pixel[0], g = pixel[1], b = pixel[2], a = pixel[3];
+            pixel[0] = DIV255(b * a);
+            pixel[1] = DIV255(g * a);
+            pixel[2] = DIV255(r * a);
+        }
+    }
+}
+
+// Blend one premultiplied pixel over framebuffer pixel
+static void composite_pixel(const unsigned char* src, unsigned char* dst) {
+    unsigned int inv = 255 - src[3];
+    dst[0] = src[0] + DIV255(dst[0] * inv);
+    dst[1] = src[1] + DIV255(dst[1] * inv);
+    dst[2] = src[2] + DIV255(dst[2] * inv);
+    dst[3] = 0;
+}
+
+#ifdef __SSE2__
+// Divide 16-bit lanes by 255 like DIV255
+static __m128i div255_epu16(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Blend 4 premultiplied pixels over 4 framebuffer pixels
+static __m128i composite_4px(__m128i src, __m128i dst, __m128i alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i inv = _mm_sub_epi32(_mm_set1_epi32(255), alpha);
+    inv = _mm_or_si128(inv, _mm_or_si128(_mm_slli_epi32(inv, 8), _mm_slli_epi32(inv, 16)));
+
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(inv, zero));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(inv, zero));
+    __m128i blended = _mm_packus_epi16(div255_epu16(lo), div255_epu16(hi));
+    return _mm_add_epi8(blended, src);
+}
+#endif
+
+void composite_bgra_rows(const unsigned char* data, int img_line_length, int width, int height,
+                         unsigned char* out, int out_line_length, int* spans) {
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src = data + y * img_line_length;
+        unsigned char* dst = out + y * out_line_length;
+        int first = -1, last = -1;
+        int x = 0;
+#ifdef __SSE2__
+        const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+        for (; x + 4 <= width; x += 4) {
+            __m128i src4 = _mm_loadu_si128((const __m128i*) (src + x*4));
+            __m128i alpha = _mm_srli_epi32(src4, 24);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) == 0xFFFF)
+                continue;
+
+            __m128i out4;
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_set1_epi32(255))) == 0xFFFF)
+                out4 = src4;
+            else
+                out4 = composite_4px(src4, _mm_loadu_si128((const __m128i*) (dst + x*4)), alpha);
+            _mm_storeu_si128((__m128i*) (dst + x*4), _mm_and_si128(out4, rgb_mask));
+
+            if (first == -1) first = x;
+            last = x + 4;
+        }
+#endif
+        for (; x < width; x++) {
+            if (src[x*4+3] == 0)
+                continue;
+            composite_pixel(src + x*4, dst + x*4);
+            if (first == -1) first = x;
+            last = x + 1;
+        }
+        spans[y*2] = first;
+        spans[y*2+1] = last;
+    }
+}
+
+void fill_rows(unsigned char* out, int out_line_length, int width, int height, unsigned int color) {
+    for (int y = 0; y < height; y++) {
+        unsigned char* dst = out + y * out_line_length;
+        for (int x = 0; x < width; x++) {
+            dst[x*4]   = color & 0xFF;
+            dst[x*4+1] = (color >> 8) & 0xFF;
+            dst[x*4+2] = (color >> 16) & 0xFF;
+            dst[x*4+3] = 0;
+        }
+    }
+}
+
+void copy_rows(const unsigned char* src, int src_line_length,
+               unsigned char* dst, int dst_line_length, int row_bytes, int height) {
+    for (int y = 0; y < height; y++)
+        memcpy(dst + y * dst_line_length, src + y * src_line_length, row_bytes);
+}
+
+void stream_copy(unsigned char* dst, const unsigned char* src, int len) {
+#ifdef __SSE2__
+    int head = (16 - ((uintptr_t) dst & 15)) & 15;
+    if (head > len) head = len;
+    memcpy(dst, src, head);
+    dst += head; src += head; len -= head;
+    for (; len >= 16; len -= 16, dst += 16, src += 16)
+        _mm_stream_si128((__m128i*) dst, _mm_loadu_si128((const __m128i*) src));
+#endif
+    memcpy(dst, src, len);
+}
+
+void store_fence(void) {
+#ifdef __SSE2__
+    _mm_sfence();
+#endif
+}
+
+// Check if *len* bytes of *a* and *b* differ
+static int row_differs(const unsigned char* a, const unsigned char* b, int len) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 64 <= len; i += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a+i)),
+                                     _mm_loadu_si128((const __m128i*) (b+i)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a+i+16)),
+                                     _mm_loadu_si128((const __m128i*) (b+i+16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a+i+32)),
+                                     _mm_loadu_si128((const __m128i*) (b+i+32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a+i+48)),
+                                     _mm_loadu_si128((const __m128i*) (b+i+48)));
+        __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            return 1;
+    }
+#endif
+    return memcmp(a+i, b+i, len-i) != 0;
+}
+
+int find_damaged_rows(const unsigned char* screen, int screen_line_length,
+                      const unsigned char* expected, int expected_line_length,
+                      int row_bytes, int height, unsigned char* damaged) {
+    int count = 0;
+    for (int y = 0; y < height; y++) {
+        damaged[y] = row_differs(screen + y * screen_line_length,
+                                 expected + y * expected_line_length, row_bytes);
+        count += damaged[y];
+    }
+    return count;
+}
+
+#endif
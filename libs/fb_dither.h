@@ -0,0 +1,251 @@
+/* fb_dither - Floyd-Steinberg error diffusion spread across threads
+ *
+ * Do this:
+ *   #define FB_DITHER_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Needs fb_blit.h (fb_format) to be included before. Link with -lpthread.
+ *
+ * Threads take rows in order from shared counter. Pixel x of a row needs errors of
+ * pixels up to x+1 of row above, so each row runs a few pixels behind the
+ * one above it (wavefront). Errors are kept as integers in sixteenths and
+ * every pixel sums the same contributions in the same order as serial
+ * code would, so output doesn't depend on number of threads and matches
+ * plain serial diffusion of fs_dither_serial exactly.
+ */
+
+#ifndef FB_DITHER_H
+#define FB_DITHER_H
+
+// Find color closest to *rgb* (0..255 each) for pixel of output format.
+// Put pixel value into *pixel* and its real color into *shown*.
+typedef void (*fs_quantize_fn)(const int* rgb, unsigned int* pixel, int* shown, const void* ctx);
+
+// Quantizer for truecolor *format* (ctx is const fb_format*)
+void fs_quantize_truecolor(const int* rgb, unsigned int* pixel, int* shown, const void* ctx);
+
+// Quantizer for pseudocolor *format* with palette (ctx is const fb_format*)
+void fs_quantize_palette(const int* rgb, unsigned int* pixel, int* shown, const void* ctx);
+
+// Dither *width* x *height* RGB image into pixels of *bytes_per_pixel*
+// bytes in *out*, using *threads* threads (0 picks number of CPUs).
+// Returns 0 on success, -1 if memory or threads couldn't be allocated.
+int fs_dither_rows(const unsigned char* data, int img_line_length, int width, int height,
+                   unsigned char* out, int out_line_length, int bytes_per_pixel,
+                   fs_quantize_fn quantize, const void* ctx, int threads);
+
+// Dither like fs_dither_rows in one pass over rows, with two rows of errors.
+// It's used for single thread and is reference threaded output must match.
+int fs_dither_serial(const unsigned char* data, int img_line_length, int width, int height,
+                     unsigned char* out, int out_line_length, int bytes_per_pixel,
+                     fs_quantize_fn quantize, const void* ctx);
+
+#endif
+
+#ifdef FB_DITHER_IMPLEMENTATION
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>    // sched_yield
+#include <unistd.h>   // sysconf
+
+// how far (in pixels) row is allowed to come to progress of row above
+#define FS_LAG 2
+// pixels processed between publishing progress
+#define FS_CHUNK 64
+#define FS_MAX_THREADS 16
+// progress counters are this many ints apart, so rows don't share cache line
+#define FS_PROGRESS_STRIDE 16
+
+void fs_quantize_truecolor(const int* rgb, unsigned int* pixel, int* shown, const void* ctx) {
+    const fb_format* format = ctx;
+    *pixel = 0;
+    for (int c = 0; c < 3; c++) {
+        int len = format->length[c];
+        int max = (1 << len) - 1;
+        int v = rgb[c] < 0 ? 0 : rgb[c] > 255 ? 255 : rgb[c];
+        int q = (v * max + 127) / 255;
+        shown[c] = (q * 255 + max/2) / max;
+        *pixel |= (unsigned int) q << format->offset[c];
+    }
+}
+
+void fs_quantize_palette(const int* rgb, unsigned int* pixel, int* shown, const void* ctx) {
+    const fb_format* format = ctx;
+    int v[3];
+    for (int c = 0; c < 3; c++)
+        v[c] = rgb[c] < 0 ? 0 : rgb[c] > 255 ? 255 : rgb[c];
+    *pixel = format->palette_lut[(v[0] >> 3) << 10 | (v[1] >> 3) << 5 | v[2] >> 3];
+    for (int c = 0; c < 3; c++)
+        shown[c] = format->palette[*pixel * 3 + c];
+}
+
+typedef struct {
+    const unsigned char* data;
+    int img_line_length, width, height;
+    unsigned char* out;
+    int out_line_length, bytes_per_pixel;
+    fs_quantize_fn quantize;
+    const void* ctx;
+    int threads;
+    int ring_rows;          // rows of error ring buffer
+    int* errors;            // ring of rows of (width+2)*3 error sums in sixteenths
+    atomic_int* progress;   // pixels finished in each row, FS_PROGRESS_STRIDE apart
+    atomic_int next_row;    // first row not taken by any thread
+} fs_job;
+
+// Wait until row *y* has finished at least *count* pixels
+static void fs_wait_progress(const fs_job* job, int y, int count) {
+    int spins = 0;
+    while (atomic_load_explicit(&job->progress[(size_t) y * FS_PROGRESS_STRIDE], memory_order_acquire) < count)
+        if (++spins > 64) {
+            sched_yield();
+            spins = 0;
+        }
+}
+
+static int* fs_error_row(const fs_job* job, int y) {
+    // one pixel of padding on both sides
+    return job->errors + (size_t) (y % job->ring_rows) * (job->width + 2) * 3 + 3;
+}
+
+static void fs_dither_row(fs_job* job, int y) {
+    int width = job->width;
+    int* cur = fs_error_row(job, y);
+    int* next = fs_error_row(job, y + 1);
+
+    // ring slot of next row was used by row which must be finished
+    if (y + 1 - job->ring_rows >= 0)
+        fs_wait_progress(job, y + 1 - job->ring_rows, width);
+    memset(next - 3, 0, sizeof(int) * (width + 2) * 3);
+
+    const unsigned char* src = job->data + (size_t) y * job->img_line_length;
+    unsigned char* dst = job->out + (size_t) y * job->out_line_length;
+    int right[3] = {0, 0, 0};   // error pushed to next pixel of this row, in sixteenths
+
+    for (int x = 0; x < width; x++) {
+        if (y > 0 && x % FS_CHUNK == 0) {
+            int need = x + FS_CHUNK + FS_LAG;
+            fs_wait_progress(job, y - 1, need < width ? need : width);
+        }
+
+        int rgb[3], shown[3];
+        for (int c = 0; c < 3; c++) {
+            int acc = cur[x*3+c] + right[c];
+            // arithmetic shift rounds toward minus infinity, same in every thread
+            rgb[c] = src[x*3+c] + ((acc + 8) >> 4);
+        }
+        unsigned int pixel;
+        job->quantize(rgb, &pixel, shown, job->ctx);
+        for (int b = 0; b < job->bytes_per_pixel; b++)
+            dst[x * job->bytes_per_pixel + b] = pixel >> (b*8);
+
+        for (int c = 0; c < 3; c++) {
+            int err = rgb[c] - shown[c];
+            right[c] = err * 7;
+            next[(x-1)*3+c] += err * 3;
+            next[x*3+c] += err * 5;
+            next[(x+1)*3+c] += err;
+        }
+
+        if ((x+1) % FS_CHUNK == 0)
+            atomic_store_explicit(&job->progress[(size_t) y * FS_PROGRESS_STRIDE], x+1, memory_order_release);
+    }
+    atomic_store_explicit(&job->progress[(size_t) y * FS_PROGRESS_STRIDE], width, memory_order_release);
+}
+
+int fs_dither_serial(const unsigned char* data, int img_line_length, int width, int height,
+                     unsigned char* out, int out_line_length, int bytes_per_pixel,
+                     fs_quantize_fn quantize, const void* ctx) {
+    if (width <= 0 || height <= 0)
+        return 0;
+    size_t row_ints = (size_t) (width + 2) * 3;
+    int* errors = calloc(row_ints * 2, sizeof(int));
+    if (errors == NULL)
+        return -1;
+
+    for (int y = 0; y < height; y++) {
+        int* cur = errors + (y & 1) * row_ints + 3;
+        int* next = errors + (~y & 1) * row_ints + 3;
+        memset(next - 3, 0, sizeof(int) * row_ints);
+        const unsigned char* src = data + (size_t) y * img_line_length;
+        unsigned char* dst = out + (size_t) y * out_line_length;
+
+        for (int x = 0; x < width; x++) {
+            int rgb[3], shown[3];
+            for (int c = 0; c < 3; c++)
+                rgb[c] = src[x*3+c] + ((cur[x*3+c] + 8) >> 4);
+            unsigned int pixel;
+            quantize(rgb, &pixel, shown, ctx);
+            for (int b = 0; b < bytes_per_pixel; b++)
+                dst[x * bytes_per_pixel + b] = pixel >> (b*8);
+
+            // 7/16 right, 3/16 down-left, 5/16 down, 1/16 down-right
+            for (int c = 0; c < 3; c++) {
+                int err = rgb[c] - shown[c];
+                cur[(x+1)*3+c] += err * 7;
+                next[(x-1)*3+c] += err * 3;
+                next[x*3+c] += err * 5;
+                next[(x+1)*3+c] += err;
+            }
+        }
+    }
+    free(errors);
+    return 0;
+}
+
+static void* fs_worker_run(void* arg) {
+    fs_job* job = arg;
+    int y;
+    while ((y = atomic_fetch_add(&job->next_row, 1)) < job->height)
+        fs_dither_row(job, y);
+    return NULL;
+}
+
+int fs_dither_rows(const unsigned char* data, int img_line_length, int width, int height,
+                   unsigned char* out, int out_line_length, int bytes_per_pixel,
+                   fs_quantize_fn quantize, const void* ctx, int threads) {
+    if (width <= 0 || height <= 0)
+        return 0;
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > FS_MAX_THREADS) threads = FS_MAX_THREADS;
+    if (threads > height) threads = height;
+    if (threads < 1) threads = 1;
+    if (threads == 1)
+        return fs_dither_serial(data, img_line_length, width, height, out, out_line_length, bytes_per_pixel,
+                                quantize, ctx);
+
+    fs_job job = {
+        data, img_line_length, width, height, out, out_line_length, bytes_per_pixel,
+        quantize, ctx, threads, 2 * threads + 2, NULL, NULL, 0
+    };
+    atomic_init(&job.next_row, 0);
+    job.errors = calloc((size_t) job.ring_rows * (width + 2) * 3, sizeof(int));
+    job.progress = malloc(sizeof(atomic_int) * FS_PROGRESS_STRIDE * height);
+    if (job.errors == NULL || job.progress == NULL) {
+        free(job.errors);
+        free(job.progress);
+        return -1;
+    }
+    for (int y = 0; y < height; y++)
+        atomic_init(&job.progress[(size_t) y * FS_PROGRESS_STRIDE], 0);
+
+    // calling thread works too, rows are finished even if some threads
+    // couldn't be started
+    pthread_t tids[FS_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1
+            && pthread_create(&tids[started], NULL, fs_worker_run, &job) == 0)
+        started++;
+    fs_worker_run(&job);
+    for (int t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+
+    free(job.errors);
+    free(job.progress);
+    return 0;
+}
+
+#endif
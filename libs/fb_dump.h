@@ -0,0 +1,193 @@
+/* fb_dump - Save framebuffer content as image file
+ *
+ * Do this:
+ *   #define FB_DUMP_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Needs fb_blit.h (fb_format) to be included before.
+ * Pixels are turned back into 8-bit RGB and written as binary PPM, or as
+ * PNG with uncompressed (stored) deflate blocks, which needs no zlib and
+ * is still read by every viewer.
+ */
+
+#ifndef FB_DUMP_H
+#define FB_DUMP_H
+
+#include <stddef.h>
+
+// Write *width* x *height* pixels of *format* from *fb* of *fb_size* bytes
+// to *path*, as PNG when path ends with ".png" and PPM otherwise.
+// Returns 0 on success, -1 also if rows at *line_length* stride don't fit in *fb_size*.
+int fb_dump(const char* path, const unsigned char* fb, size_t fb_size, int line_length, int width, int height,
+            const fb_format* format);
+
+// Turn row of *width* pixels of *format* from *src* into 8-bit RGB in *rgb*
+void fb_dump_row(const unsigned char* src, int width, const fb_format* format, unsigned char* rgb);
+
+#endif
+
+#ifdef FB_DUMP_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void fb_dump_row(const unsigned char* src, int width, const fb_format* format, unsigned char* rgb) {
+    int bpp = format->bytes_per_pixel;
+    for (int x = 0; x < width; x++, src += bpp) {
+        unsigned int pixel = 0;
+        for (int b = 0; b < bpp; b++)
+            pixel |= (unsigned int) src[b] << (b*8);
+        if (format->palette != NULL) {
+            memcpy(rgb + x*3, format->palette + pixel * 3, 3);
+            continue;
+        }
+        for (int c = 0; c < 3; c++) {
+            unsigned int max = (1u << format->length[c]) - 1;
+            unsigned int value = (pixel >> format->offset[c]) & max;
+            rgb[x*3+c] = max == 255 ? value : (value * 255 + max/2) / max;
+        }
+    }
+}
+
+typedef struct {
+    FILE* file;
+    unsigned int crc;       // of current PNG chunk
+    unsigned int adler[2];  // of zlib data
+} fb_dump_png;
+
+static unsigned int fb_dump_crc_table[256];
+
+static void fb_dump_crc_init(void) {
+    for (unsigned int n = 0; n < 256; n++) {
+        unsigned int c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        fb_dump_crc_table[n] = c;
+    }
+}
+
+// Write bytes of chunk, counting them into chunk CRC
+static void fb_dump_put(fb_dump_png* png, const unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        png->crc = fb_dump_crc_table[(png->crc ^ data[i]) & 0xFF] ^ (png->crc >> 8);
+    fwrite(data, 1, len, png->file);
+}
+
+static void fb_dump_put32(fb_dump_png* png, unsigned int value) {
+    unsigned char bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+    fb_dump_put(png, bytes, 4);
+}
+
+// Write length and type of chunk and start its CRC
+static void fb_dump_chunk(fb_dump_png* png, const char* type, unsigned int len) {
+    unsigned char bytes[4] = {len >> 24, len >> 16, len >> 8, len};
+    fwrite(bytes, 1, 4, png->file);
+    png->crc = 0xFFFFFFFFu;
+    fb_dump_put(png, (const unsigned char*) type, 4);
+}
+
+static void fb_dump_chunk_end(fb_dump_png* png) {
+    unsigned int crc = png->crc ^ 0xFFFFFFFFu;
+    unsigned char bytes[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+    fwrite(bytes, 1, 4, png->file);
+}
+
+// Write image data, counting it into Adler-32 of zlib stream too
+static void fb_dump_put_data(fb_dump_png* png, const unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        png->adler[0] = (png->adler[0] + data[i]) % 65521;
+        png->adler[1] = (png->adler[1] + png->adler[0]) % 65521;
+    }
+    fb_dump_put(png, data, len);
+}
+
+#define FB_DUMP_STORED_MAX 65535
+
+static int fb_dump_write_png(FILE* file, const unsigned char* fb, int line_length, int width, int height,
+                             const fb_format* format, unsigned char* row) {
+    fb_dump_crc_init();
+    fb_dump_png png = {file, 0, {1, 0}};
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    fb_dump_chunk(&png, "IHDR", 13);
+    fb_dump_put32(&png, width);
+    fb_dump_put32(&png, height);
+    // 8 bits per channel, RGB, no interlace
+    static const unsigned char ihdr_rest[5] = {8, 2, 0, 0, 0};
+    fb_dump_put(&png, ihdr_rest, 5);
+    fb_dump_chunk_end(&png);
+
+    // every row is filter byte 0 and RGB pixels, split into stored blocks
+    size_t raw_len = (size_t) height * (1 + (size_t) width * 3);
+    size_t blocks = (raw_len + FB_DUMP_STORED_MAX - 1) / FB_DUMP_STORED_MAX;
+    if (2 + raw_len + blocks * 5 + 4 > 0x7FFFFFFFu)
+        return -1;
+    fb_dump_chunk(&png, "IDAT", 2 + raw_len + blocks * 5 + 4);
+    static const unsigned char zlib_header[2] = {0x78, 0x01};
+    fb_dump_put(&png, zlib_header, 2);
+
+    size_t left = raw_len, block_left = 0;
+    for (int y = 0; y < height; y++) {
+        row[0] = 0;
+        fb_dump_row(fb + (size_t) y * line_length, width, format, row + 1);
+        size_t row_len = 1 + (size_t) width * 3, done = 0;
+        while (done < row_len) {
+            if (block_left == 0) {
+                block_left = left < FB_DUMP_STORED_MAX ? left : FB_DUMP_STORED_MAX;
+                unsigned char header[5] = {
+                    block_left == left, block_left & 0xFF, block_left >> 8,
+                    ~block_left & 0xFF, (~block_left >> 8) & 0xFF
+                };
+                fb_dump_put(&png, header, 5);
+            }
+            size_t part = row_len - done < block_left ? row_len - done : block_left;
+            fb_dump_put_data(&png, row + done, part);
+            done += part;
+            block_left -= part;
+            left -= part;
+        }
+    }
+    fb_dump_put32(&png, png.adler[1] << 16 | png.adler[0]);
+    fb_dump_chunk_end(&png);
+
+    fb_dump_chunk(&png, "IEND", 0);
+    fb_dump_chunk_end(&png);
+    return 0;
+}
+
+int fb_dump(const char* path, const unsigned char* fb, size_t fb_size, int line_length, int width, int height,
+            const fb_format* format) {
+    if (width <= 0 || height <= 0 || line_length < width * format->bytes_per_pixel
+            || (size_t) (height - 1) * line_length + (size_t) width * format->bytes_per_pixel > fb_size)
+        return -1;
+    size_t path_len = strlen(path);
+    int as_png = path_len >= 4 && strcmp(path + path_len - 4, ".png") == 0;
+    unsigned char* row = malloc(1 + (size_t) width * 3);
+    FILE* file = fopen(path, "wb");
+    if (row == NULL || file == NULL) {
+        free(row);
+        if (file != NULL)
+            fclose(file);
+        return -1;
+    }
+
+    int failed = 0;
+    if (as_png) {
+        failed = fb_dump_write_png(file, fb, line_length, width, height, format, row);
+    } else {
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        for (int y = 0; y < height; y++) {
+            fb_dump_row(fb + (size_t) y * line_length, width, format, row);
+            fwrite(row, 3, width, file);
+        }
+    }
+    failed |= ferror(file);
+    failed |= fclose(file) != 0;
+    free(row);
+    if (failed)
+        remove(path);
+    return failed ? -1 : 0;
+}
+
+#endif
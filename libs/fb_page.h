@@ -0,0 +1,226 @@
+/* fb_page - Tear-free presenting of frames on framebuffer
+ *
+ * Do this:
+ *   #define FB_PAGE_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * When virtual screen has room for two pages and console is in graphics
+ * mode, frame is drawn into hidden page which is then shown with
+ * FBIOPAN_DISPLAY at vertical blank. In text mode fbcon keeps drawing on
+ * page it pans to itself, so frame is drawn to visible page (at current
+ * yoffset) right after vertical blank (FBIO_WAITFORVSYNC) or, if driver
+ * can't wait for it, not more often than once per refresh period.
+ */
+
+#ifndef FB_PAGE_H
+#define FB_PAGE_H
+
+#include <time.h>      // timespec
+#include <linux/fb.h>  // fb_var_screeninfo
+
+typedef struct {
+    int fbfd;
+    char* map;              // whole virtual screen, NULL if it couldn't be mapped
+    long map_size;
+    int line_length;
+    struct fb_var_screeninfo vinfo; // yoffset is offset of visible page
+    unsigned int page_yoffset[2];   // yoffset of visible and hidden page
+    int flipping;           // hidden page is used
+    unsigned int initial_yoffset;   // page visible before fb_pages_init
+    int can_vsync;          // FBIO_WAITFORVSYNC works
+    long frame_ns;          // refresh period
+    struct timespec last_present;
+} fb_pages;
+
+// Check if driver can wait for vertical blank. Blocks for up to one frame.
+int fb_probe_vsync(int fbfd);
+
+// Get refresh period in nanoseconds from display timings,
+// 60 Hz when driver doesn't report them.
+long fb_frame_ns(const struct fb_var_screeninfo* vinfo);
+
+// Check if console on *ttyfd* is in graphics mode (KD_GRAPHICS), so fbcon
+// doesn't draw or pan.
+int fb_console_graphics(int ttyfd);
+
+// Set up presenting on *fbfd*. Page flipping is used when *want_flip*,
+// console on *ttyfd* is in graphics mode, driver can pan vertically
+// (*ypanstep* > 0) and virtual screen has room for second page.
+// Returns 1 when flipping, 0 otherwise.
+int fb_pages_init(fb_pages* pages, int fbfd, int ttyfd, int line_length, int ypanstep, int can_vsync,
+                  int want_flip);
+
+// Get visible page, NULL if screen couldn't be mapped, and hidden page,
+// NULL when not flipping
+char* fb_pages_front(const fb_pages* pages);
+char* fb_pages_back(const fb_pages* pages);
+
+// Wait until it's time to present next frame (vertical blank or pacing).
+// Without flipping visible page is looked up again, fbcon may have panned.
+void fb_pages_wait(fb_pages* pages);
+
+// Show hidden page at next vertical blank, visible page becomes hidden.
+// Returns 0 on success.
+int fb_pages_flip(fb_pages* pages);
+
+// Show page which was visible at fb_pages_init and release pages.
+// Caller must keep final frame on both pages.
+void fb_pages_release(fb_pages* pages);
+
+#endif
+
+#ifdef FB_PAGE_IMPLEMENTATION
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/kd.h>  // KDGETMODE
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)
+#endif
+
+int fb_probe_vsync(int fbfd) {
+    __u32 crtc = 0;
+    return ioctl(fbfd, FBIO_WAITFORVSYNC, &crtc) == 0;
+}
+
+long fb_frame_ns(const struct fb_var_screeninfo* vinfo) {
+    long long htotal = vinfo->xres + vinfo->left_margin + vinfo->right_margin + vinfo->hsync_len;
+    long long vtotal = vinfo->yres + vinfo->upper_margin + vinfo->lower_margin + vinfo->vsync_len;
+    if (vinfo->pixclock == 0)
+        return 1000000000L / 60;
+    // pixclock is in picoseconds
+    return (long) (vinfo->pixclock * htotal * vtotal / 1000);
+}
+
+int fb_console_graphics(int ttyfd) {
+    int mode;
+    return ioctl(ttyfd, KDGETMODE, &mode) == 0 && mode == KD_GRAPHICS;
+}
+
+int fb_pages_init(fb_pages* pages, int fbfd, int ttyfd, int line_length, int ypanstep, int can_vsync,
+                  int want_flip) {
+    memset(pages, 0, sizeof(*pages));
+    pages->fbfd = fbfd;
+    pages->line_length = line_length;
+    pages->can_vsync = can_vsync;
+    if (ioctl(fbfd, FBIOGET_VSCREENINFO, &pages->vinfo) == -1)
+        return 0;
+    pages->frame_ns = fb_frame_ns(&pages->vinfo);
+    clock_gettime(CLOCK_MONOTONIC, &pages->last_present);
+
+    // visible page is at yoffset, which fbcon moves when it scrolls by panning
+    const struct fb_var_screeninfo* vinfo = &pages->vinfo;
+    pages->initial_yoffset = vinfo->yoffset;
+    pages->page_yoffset[0] = vinfo->yoffset;
+    pages->map_size = (long) line_length * vinfo->yres_virtual;
+    pages->map = mmap(NULL, pages->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
+    if (pages->map == MAP_FAILED) {
+        pages->map = NULL;
+        return 0;
+    }
+
+    if (!want_flip || !fb_console_graphics(ttyfd) || ypanstep == 0
+            || vinfo->yres_virtual < 2 * vinfo->yres || vinfo->yres % ypanstep != 0)
+        return 0;
+
+    // hidden page goes after visible one, or before if there is no room
+    if (vinfo->yoffset + 2 * vinfo->yres <= vinfo->yres_virtual)
+        pages->page_yoffset[1] = vinfo->yoffset + vinfo->yres;
+    else if (vinfo->yoffset >= vinfo->yres)
+        pages->page_yoffset[1] = vinfo->yoffset - vinfo->yres;
+    else
+        return 0;
+    pages->flipping = 1;
+
+    // hidden page starts as copy of visible one
+    memcpy(fb_pages_back(pages), fb_pages_front(pages), (size_t) line_length * vinfo->yres);
+    return 1;
+}
+
+char* fb_pages_front(const fb_pages* pages) {
+    if (pages->map == NULL)
+        return NULL;
+    return pages->map + (long) pages->page_yoffset[0] * pages->line_length;
+}
+
+char* fb_pages_back(const fb_pages* pages) {
+    if (!pages->flipping)
+        return NULL;
+    return pages->map + (long) pages->page_yoffset[1] * pages->line_length;
+}
+
+// Add *ns* nanoseconds to *ts*
+static void fb_timespec_add(struct timespec* ts, long ns) {
+    ts->tv_nsec += ns;
+    ts->tv_sec += ts->tv_nsec / 1000000000L;
+    ts->tv_nsec %= 1000000000L;
+}
+
+// Follow yoffset of visible page when not flipping
+static void fb_pages_find_front(fb_pages* pages) {
+    struct fb_var_screeninfo vinfo;
+    if (!pages->flipping && ioctl(pages->fbfd, FBIOGET_VSCREENINFO, &vinfo) == 0
+            && vinfo.yoffset + pages->vinfo.yres <= pages->vinfo.yres_virtual)
+        pages->page_yoffset[0] = vinfo.yoffset;
+}
+
+void fb_pages_wait(fb_pages* pages) {
+    fb_pages_find_front(pages);
+    if (pages->can_vsync) {
+        __u32 crtc = 0;
+        if (ioctl(pages->fbfd, FBIO_WAITFORVSYNC, &crtc) == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &pages->last_present);
+            return;
+        }
+    }
+
+    // pace frames to refresh period since last presented frame
+    struct timespec next = pages->last_present, now;
+    fb_timespec_add(&next, pages->frame_ns);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec < next.tv_nsec)) {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+        pages->last_present = next;
+    } else {
+        pages->last_present = now;
+    }
+}
+
+// Pan display to page with *yoffset*
+static int fb_pages_pan(fb_pages* pages, unsigned int yoffset) {
+    struct fb_var_screeninfo vinfo = pages->vinfo;
+    vinfo.yoffset = yoffset;
+    vinfo.activate = FB_ACTIVATE_VBL;
+    if (ioctl(pages->fbfd, FBIOPAN_DISPLAY, &vinfo) == -1)
+        return -1;
+    pages->vinfo.yoffset = yoffset;
+    return 0;
+}
+
+int fb_pages_flip(fb_pages* pages) {
+    if (!pages->flipping)
+        return -1;
+    if (pages->can_vsync)
+        fb_pages_wait(pages);
+    if (fb_pages_pan(pages, pages->page_yoffset[1]) == -1)
+        return -1;
+
+    unsigned int shown = pages->page_yoffset[1];
+    pages->page_yoffset[1] = pages->page_yoffset[0];
+    pages->page_yoffset[0] = shown;
+    return 0;
+}
+
+void fb_pages_release(fb_pages* pages) {
+    if (pages->map == NULL)
+        return;
+    if (pages->flipping && pages->vinfo.yoffset != pages->initial_yoffset)
+        fb_pages_pan(pages, pages->initial_yoffset);
+    munmap(pages->map, pages->map_size);
+    pages->map = NULL;
+    pages->flipping = 0;
+}
+
+#endif
@@ -0,0 +1,169 @@
+/* fb_palette - Palette of 8bpp pseudocolor framebuffer
+ *
+ * Do this:
+ *   #define FB_PALETTE_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Pixels of pseudocolor framebuffer are indices into palette (color map).
+ * Palette is read from driver, or installed: first 16 entries are left
+ * to console text colors, rest gets 6x6x6 color cube and gray ramp.
+ * Nearest entry for every color with 5 bits per channel is precomputed
+ * into 32x32x32 table, so converting a pixel is one table load.
+ * Color map can be saved before installing and put back later.
+ */
+
+#ifndef FB_PALETTE_H
+#define FB_PALETTE_H
+
+typedef struct {
+    int size;                       // number of entries
+    unsigned char colors[256][3];   // RGB of each entry
+    unsigned char lut[32*32*32];    // nearest entry at (r>>3)<<10 | (g>>3)<<5 | b>>3
+} fb_palette;
+
+// Color map as driver keeps it, 16 bits per channel
+typedef struct {
+    int size;
+    unsigned short red[256], green[256], blue[256];
+} fb_palette_saved;
+
+// Read palette of *bits_per_pixel* deep framebuffer. Returns 0 on success.
+int fb_palette_read(int fbfd, int bits_per_pixel, fb_palette* palette);
+
+// Fill 256 entries with standard VGA console colors, color cube and gray ramp
+void fb_palette_standard(fb_palette* palette);
+
+// Install color cube and gray ramp above 16 console colors, which are
+// read first and kept. Returns 0 on success.
+int fb_palette_install(int fbfd, int bits_per_pixel, fb_palette* palette);
+
+// Fill palette->lut with nearest entries of palette->colors
+void fb_palette_build_lut(fb_palette* palette);
+
+// Read whole color map of *bits_per_pixel* deep framebuffer into *saved*.
+// Returns 0 on success.
+int fb_palette_save(int fbfd, int bits_per_pixel, fb_palette_saved* saved);
+
+// Put color map from *saved* back. It's a single ioctl, so it can be
+// called from signal handler. Returns 0 on success.
+int fb_palette_restore(int fbfd, const fb_palette_saved* saved);
+
+#endif
+
+#ifdef FB_PALETTE_IMPLEMENTATION
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/fb.h>
+
+#define FB_PALETTE_CONSOLE_COLORS 16
+
+// Get *count* entries starting at *start* into palette->colors
+static int fb_palette_get(int fbfd, int start, int count, fb_palette* palette) {
+    __u16 red[256], green[256], blue[256];
+    struct fb_cmap cmap = {start, count, red, green, blue, NULL};
+    if (ioctl(fbfd, FBIOGETCMAP, &cmap) == -1)
+        return -1;
+    // entries are 16 bits per channel
+    for (int i = 0; i < count; i++) {
+        palette->colors[start+i][0] = red[i] >> 8;
+        palette->colors[start+i][1] = green[i] >> 8;
+        palette->colors[start+i][2] = blue[i] >> 8;
+    }
+    return 0;
+}
+
+int fb_palette_read(int fbfd, int bits_per_pixel, fb_palette* palette) {
+    if (bits_per_pixel < 1 || bits_per_pixel > 8)
+        return -1;
+    palette->size = 1 << bits_per_pixel;
+    return fb_palette_get(fbfd, 0, palette->size, palette);
+}
+
+void fb_palette_standard(fb_palette* palette) {
+    palette->size = 256;
+    static const unsigned char vga[FB_PALETTE_CONSOLE_COLORS][3] = {
+        {0, 0, 0}, {170, 0, 0}, {0, 170, 0}, {170, 85, 0},
+        {0, 0, 170}, {170, 0, 170}, {0, 170, 170}, {170, 170, 170},
+        {85, 85, 85}, {255, 85, 85}, {85, 255, 85}, {255, 255, 85},
+        {85, 85, 255}, {255, 85, 255}, {85, 255, 255}, {255, 255, 255}
+    };
+    memcpy(palette->colors, vga, sizeof(vga));
+
+    // 216 entries of 6x6x6 cube, then 24 grays between its levels
+    static const unsigned char levels[6] = {0, 95, 135, 175, 215, 255};
+    int i = FB_PALETTE_CONSOLE_COLORS;
+    for (int r = 0; r < 6; r++)
+        for (int g = 0; g < 6; g++)
+            for (int b = 0; b < 6; b++, i++) {
+                palette->colors[i][0] = levels[r];
+                palette->colors[i][1] = levels[g];
+                palette->colors[i][2] = levels[b];
+            }
+    for (int gray = 0; i < 256; i++, gray++)
+        memset(palette->colors[i], 8 + gray * 10, 3);
+}
+
+int fb_palette_install(int fbfd, int bits_per_pixel, fb_palette* palette) {
+    if (bits_per_pixel != 8)
+        return -1;
+    // unknown console colors are taken as standard VGA ones
+    fb_palette_standard(palette);
+    fb_palette_get(fbfd, 0, FB_PALETTE_CONSOLE_COLORS, palette);
+
+    __u16 red[256], green[256], blue[256];
+    int count = 256 - FB_PALETTE_CONSOLE_COLORS;
+    for (int k = 0; k < count; k++) {
+        const unsigned char* color = palette->colors[FB_PALETTE_CONSOLE_COLORS + k];
+        red[k] = color[0] * 0x101;
+        green[k] = color[1] * 0x101;
+        blue[k] = color[2] * 0x101;
+    }
+    struct fb_cmap cmap = {FB_PALETTE_CONSOLE_COLORS, count, red, green, blue, NULL};
+    return ioctl(fbfd, FBIOPUTCMAP, &cmap) == -1 ? -1 : 0;
+}
+
+int fb_palette_save(int fbfd, int bits_per_pixel, fb_palette_saved* saved) {
+    if (bits_per_pixel < 1 || bits_per_pixel > 8)
+        return -1;
+    saved->size = 1 << bits_per_pixel;
+    struct fb_cmap cmap = {0, saved->size, saved->red, saved->green, saved->blue, NULL};
+    return ioctl(fbfd, FBIOGETCMAP, &cmap) == -1 ? -1 : 0;
+}
+
+int fb_palette_restore(int fbfd, const fb_palette_saved* saved) {
+    // driver doesn't write through cmap
+    struct fb_cmap cmap = {0, saved->size, (__u16*) saved->red, (__u16*) saved->green, (__u16*) saved->blue, NULL};
+    return ioctl(fbfd, FBIOPUTCMAP, &cmap) == -1 ? -1 : 0;
+}
+
+void fb_palette_build_lut(fb_palette* palette) {
+    // distance is weighted sum of squares, weights roughly follow
+    // sensitivity of eye; red and green parts are summed once per row
+    int dist_r[256], dist_rg[256];
+    for (int r = 0; r < 32; r++) {
+        // center of cell of colors which share 5 upper bits
+        for (int i = 0; i < palette->size; i++) {
+            int d = r*8 + 4 - palette->colors[i][0];
+            dist_r[i] = 3*d*d;
+        }
+        for (int g = 0; g < 32; g++) {
+            for (int i = 0; i < palette->size; i++) {
+                int d = g*8 + 4 - palette->colors[i][1];
+                dist_rg[i] = dist_r[i] + 4*d*d;
+            }
+            for (int b = 0; b < 32; b++) {
+                int best = 0, best_dist = 1 << 30;
+                for (int i = 0; i < palette->size; i++) {
+                    int d = b*8 + 4 - palette->colors[i][2];
+                    int dist = dist_rg[i] + 2*d*d;
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        best = i;
+                    }
+                }
+                palette->lut[(r << 10) | (g << 5) | b] = best;
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,134 @@
+/* fb_raw - Image stored in framebuffer pixel format
+ *
+ * Do this:
+ *   #define FB_RAW_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Needs fb_blit.h (fb_format) and fb_dump.h (fb_dump_row) to be included before.
+ * Raw image is converted once (fbtty --convert=raw) and then drawn on
+ * framebuffer of the same format by copying its rows, with no decoding.
+ * File is 32-byte header followed by rows of pixels:
+ *   0   "fbttyraw"
+ *   8   width, height, line length in bytes, bits per pixel
+ *       (32-bit little-endian each)
+ *   24  bit offset of red, green, blue, bit length of red, green, blue
+ *       (one byte each), 2 zero bytes
+ *   32  height rows of line length bytes, pixels little-endian
+ * Rows can be padded, line length is at least width * bits per pixel / 8.
+ */
+
+#ifndef FB_RAW_H
+#define FB_RAW_H
+
+#include <stddef.h>
+
+#define FB_RAW_HEADER 32
+
+typedef struct {
+    int width, height;
+    int line_length;
+    fb_format format;               // truecolor, palette is NULL
+    const unsigned char* pixels;    // first row, in parsed file
+} fb_raw;
+
+// Check if *file* of *size* bytes is complete raw image and describe it in *raw*.
+// Returns 0 if it is.
+int fb_raw_parse(const unsigned char* file, size_t size, fb_raw* raw);
+
+// Check if pixels of *raw* are already in *format*
+int fb_raw_matches(const fb_raw* raw, const fb_format* format);
+
+// Unpack pixels of *raw* into RGB image with width * 3 bytes per line
+void fb_raw_to_rgb(const fb_raw* raw, unsigned char* rgb);
+
+// Write *width* x *height* pixels of truecolor *format* from *pixels* to *path*.
+// Returns 0 on success.
+int fb_raw_write(const char* path, const unsigned char* pixels, int line_length, int width, int height,
+                 const fb_format* format);
+
+#endif
+
+#ifdef FB_RAW_IMPLEMENTATION
+#include <stdio.h>
+#include <string.h>
+
+static const char fb_raw_magic[8] = {'f', 'b', 't', 't', 'y', 'r', 'a', 'w'};
+
+static unsigned int fb_raw_get32(const unsigned char* bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned int) bytes[3] << 24;
+}
+
+static void fb_raw_put32(unsigned char* bytes, unsigned int value) {
+    for (int i = 0; i < 4; i++)
+        bytes[i] = value >> (i*8);
+}
+
+int fb_raw_parse(const unsigned char* file, size_t size, fb_raw* raw) {
+    if (size < FB_RAW_HEADER || memcmp(file, fb_raw_magic, 8) != 0)
+        return -1;
+    unsigned int width = fb_raw_get32(file + 8), height = fb_raw_get32(file + 12);
+    unsigned int line_length = fb_raw_get32(file + 16), bits_per_pixel = fb_raw_get32(file + 20);
+    if (bits_per_pixel != 16 && bits_per_pixel != 24 && bits_per_pixel != 32)
+        return -1;
+    if (width == 0 || height == 0 || width > 1 << 24 || height > 1 << 24 || line_length > 1u << 30
+            || line_length < width * (bits_per_pixel / 8)
+            || (size - FB_RAW_HEADER) / line_length < height)
+        return -1;
+    for (int c = 0; c < 3; c++) {
+        unsigned int offset = file[24 + c], length = file[27 + c];
+        if (length == 0 || length > 8 || offset + length > bits_per_pixel)
+            return -1;
+        raw->format.offset[c] = offset;
+        raw->format.length[c] = length;
+    }
+    raw->width = width;
+    raw->height = height;
+    raw->line_length = line_length;
+    raw->format.bytes_per_pixel = bits_per_pixel / 8;
+    raw->format.palette = NULL;
+    raw->format.palette_lut = NULL;
+    raw->pixels = file + FB_RAW_HEADER;
+    return 0;
+}
+
+int fb_raw_matches(const fb_raw* raw, const fb_format* format) {
+    if (format->palette != NULL || format->bytes_per_pixel != raw->format.bytes_per_pixel)
+        return 0;
+    for (int c = 0; c < 3; c++)
+        if (format->offset[c] != raw->format.offset[c] || format->length[c] != raw->format.length[c])
+            return 0;
+    return 1;
+}
+
+void fb_raw_to_rgb(const fb_raw* raw, unsigned char* rgb) {
+    for (int y = 0; y < raw->height; y++)
+        fb_dump_row(raw->pixels + (size_t) y * raw->line_length, raw->width, &raw->format,
+                    rgb + (size_t) y * raw->width * 3);
+}
+
+int fb_raw_write(const char* path, const unsigned char* pixels, int line_length, int width, int height,
+                 const fb_format* format) {
+    unsigned char header[FB_RAW_HEADER] = {0};
+    memcpy(header, fb_raw_magic, 8);
+    fb_raw_put32(header + 8, width);
+    fb_raw_put32(header + 12, height);
+    fb_raw_put32(header + 16, line_length);
+    fb_raw_put32(header + 20, format->bytes_per_pixel * 8);
+    for (int c = 0; c < 3; c++) {
+        header[24 + c] = format->offset[c];
+        header[27 + c] = format->length[c];
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return -1;
+    fwrite(header, 1, FB_RAW_HEADER, file);
+    fwrite(pixels, line_length, height, file);
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    if (failed)
+        remove(path);
+    return failed ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,243 @@
+/* fb_rotate - Turned and mirrored images, rotated console (fbcon rotate)
+ *
+ * Do this:
+ *   #define FB_ROTATE_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Orientation is FB_ROTATE_UR (0), FB_ROTATE_CW (1), FB_ROTATE_UD (2) or
+ * FB_ROTATE_CCW (3), same as in /sys/class/graphics/fbcon/rotate, possibly
+ * with FB_ROTATE_MIRROR added. Image is mirrored left to right first, then
+ * turned clockwise by 90 degrees per step. On CW console text which reads
+ * left to right runs top to bottom on panel.
+ *
+ * Parts of turned image are copied out of source image on demand, so
+ * caller can turn image in bands while converting it and never needs
+ * second copy of whole image. Turning by 90 or 270 degrees is
+ * transposition, which done naively reads one image along rows and writes
+ * the other along columns, missing cache on nearly every pixel. Here it's
+ * done in 16x16 blocks which fit in L1 cache for both images, and 4-byte
+ * pixels are moved as 4x4 tiles transposed in SSE2 registers.
+ */
+
+#ifndef FB_ROTATE_H
+#define FB_ROTATE_H
+
+#include <linux/fb.h> // FB_ROTATE_*
+
+#define FB_ROTATE_MIRROR 4
+
+// Get rotation of framebuffer console, FB_ROTATE_UR if it's unknown.
+int fb_rotate_read_console(void);
+
+// Get orientation which shows image with EXIF Orientation tag *exif* upright.
+int fb_rotate_from_exif(int exif);
+
+// Get orientation equal to applying *first* and then *then*.
+int fb_rotate_compose(int first, int then);
+
+// Get orientation which undoes *orientation*.
+int fb_rotate_inverse(int orientation);
+
+// Check if *orientation* swaps width and height
+int fb_rotate_is_sideways(int orientation);
+
+// Map rectangle at *pos* of *size* in space of *extent* size to rectangle
+// in same space with *orientation* applied.
+void fb_rotate_rect(int orientation, const int* extent, const int* pos, const int* size,
+                    int* out_pos, int* out_size);
+
+// Copy rectangle at *pos* of *size* of *width* x *height* image *src* with
+// *orientation* applied into *dst*. *pos* and *size* are in turned image,
+// *channels* is number of bytes per pixel.
+void fb_rotate_region(const unsigned char* src, int src_line_length, int width, int height, int channels,
+                      int orientation, const int* pos, const int* size,
+                      unsigned char* dst, int dst_line_length);
+
+#endif
+
+#ifdef FB_ROTATE_IMPLEMENTATION
+#include <stdio.h>
+#include <string.h> // memcpy
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FB_ROTATE_BLOCK 16
+
+int fb_rotate_read_console(void) {
+    FILE* file = fopen("/sys/class/graphics/fbcon/rotate", "r");
+    if (file == NULL)
+        return FB_ROTATE_UR;
+    int rotation = FB_ROTATE_UR;
+    if (fscanf(file, "%d", &rotation) != 1 || rotation < FB_ROTATE_UR || rotation > FB_ROTATE_CCW)
+        rotation = FB_ROTATE_UR;
+    fclose(file);
+    return rotation;
+}
+
+int fb_rotate_from_exif(int exif) {
+    switch (exif) {
+        case 2: return FB_ROTATE_UR | FB_ROTATE_MIRROR;
+        case 3: return FB_ROTATE_UD;
+        case 4: return FB_ROTATE_UD | FB_ROTATE_MIRROR;
+        case 5: return FB_ROTATE_CCW | FB_ROTATE_MIRROR;  // transpose
+        case 6: return FB_ROTATE_CW;
+        case 7: return FB_ROTATE_CW | FB_ROTATE_MIRROR;   // transverse
+        case 8: return FB_ROTATE_CCW;
+        default: return FB_ROTATE_UR;
+    }
+}
+
+int fb_rotate_compose(int first, int then) {
+    int turns = first & 3, mirror = first & FB_ROTATE_MIRROR;
+    // mirroring turned image is the same as mirroring first and turning other way
+    if (then & FB_ROTATE_MIRROR)
+        turns = -turns;
+    return ((turns + then) & 3) | (mirror ^ (then & FB_ROTATE_MIRROR));
+}
+
+int fb_rotate_inverse(int orientation) {
+    // mirrored orientations undo themselves
+    return orientation & FB_ROTATE_MIRROR ? orientation : (4 - orientation) & 3;
+}
+
+int fb_rotate_is_sideways(int orientation) {
+    return (orientation & 1) != 0;
+}
+
+void fb_rotate_rect(int orientation, const int* extent, const int* pos, const int* size,
+                    int* out_pos, int* out_size) {
+    int x = pos[0], y = pos[1], w = size[0], h = size[1];
+    if (orientation & FB_ROTATE_MIRROR)
+        x = extent[0] - x - w;
+    switch (orientation & 3) {
+        case FB_ROTATE_CW:
+            out_pos[0] = extent[1] - y - h;
+            out_pos[1] = x;
+            break;
+        case FB_ROTATE_UD:
+            out_pos[0] = extent[0] - x - w;
+            out_pos[1] = extent[1] - y - h;
+            break;
+        case FB_ROTATE_CCW:
+            out_pos[0] = y;
+            out_pos[1] = extent[0] - x - w;
+            break;
+        default:
+            out_pos[0] = x;
+            out_pos[1] = y;
+    }
+    int sideways = fb_rotate_is_sideways(orientation);
+    out_size[0] = sideways ? h : w;
+    out_size[1] = sideways ? w : h;
+}
+
+static inline void fb_rotate_copy_pixel(unsigned char* dst, const unsigned char* src, int channels) {
+    if (channels == 4)
+        memcpy(dst, src, 4);
+    else if (channels == 3)
+        memcpy(dst, src, 3);
+    else
+        memcpy(dst, src, channels);
+}
+
+// Copy *width* x *height* pixels, where next pixel of row is *step_x* bytes
+// after previous one in source and next row starts *step_y* bytes after.
+static inline void fb_rotate_walk(const unsigned char* src, long step_x, long step_y, int width, int height,
+                                  int channels, unsigned char* dst, int dst_line_length) {
+    for (int y = 0; y < height; y++) {
+        const unsigned char* from = src + y * step_y;
+        unsigned char* to = dst + (size_t) y * dst_line_length;
+        for (int x = 0; x < width; x++, from += step_x)
+            fb_rotate_copy_pixel(to + x * channels, from, channels);
+    }
+}
+
+// fb_rotate_walk with constant channels, so pixel copies become single moves
+static void fb_rotate_walk_any(const unsigned char* src, long step_x, long step_y, int width, int height,
+                               int channels, unsigned char* dst, int dst_line_length) {
+    if (channels == 3)
+        fb_rotate_walk(src, step_x, step_y, width, height, 3, dst, dst_line_length);
+    else if (channels == 4)
+        fb_rotate_walk(src, step_x, step_y, width, height, 4, dst, dst_line_length);
+    else
+        fb_rotate_walk(src, step_x, step_y, width, height, channels, dst, dst_line_length);
+}
+
+#ifdef __SSE2__
+// Copy 4x4 tile of 4-byte pixels whose rows are columns in source.
+// *src* is source of left-top pixel, *step_x* is +-line length of source
+// and *step_y* is +-4.
+static inline void fb_rotate_tile4(const unsigned char* src, long step_x, long step_y,
+                                   unsigned char* dst, int dst_line_length) {
+    // source rows of tile, pixels in memory order
+    __m128i r[4];
+    for (int i = 0; i < 4; i++)
+        r[i] = _mm_loadu_si128((const __m128i*) (src + i * step_x + (step_y < 0 ? 3 * step_y : 0)));
+    __m128i ab_lo = _mm_unpacklo_epi32(r[0], r[1]), cd_lo = _mm_unpacklo_epi32(r[2], r[3]);
+    __m128i ab_hi = _mm_unpackhi_epi32(r[0], r[1]), cd_hi = _mm_unpackhi_epi32(r[2], r[3]);
+    __m128i col[4] = {
+        _mm_unpacklo_epi64(ab_lo, cd_lo), _mm_unpackhi_epi64(ab_lo, cd_lo),
+        _mm_unpacklo_epi64(ab_hi, cd_hi), _mm_unpackhi_epi64(ab_hi, cd_hi)
+    };
+    for (int j = 0; j < 4; j++)
+        _mm_storeu_si128((__m128i*) (dst + j * dst_line_length), col[step_y < 0 ? 3-j : j]);
+}
+#endif
+
+void fb_rotate_region(const unsigned char* src, int src_line_length, int width, int height, int channels,
+                      int orientation, const int* pos, const int* size,
+                      unsigned char* dst, int dst_line_length) {
+    // map left-top corner of region and its right and bottom neighbours back
+    // to source to get address of first pixel and steps between pixels
+    int extent[2] = {width, height};
+    int turned[2], origin[2];
+    fb_rotate_rect(orientation, extent, (int[]){0, 0}, extent, origin, turned);
+    int inverse = fb_rotate_inverse(orientation);
+    long offset[3];
+    for (int k = 0; k < 3; k++) {
+        int p[2] = {pos[0] + (k == 1), pos[1] + (k == 2)};
+        int s[2], one[2];
+        fb_rotate_rect(inverse, turned, p, (int[]){1, 1}, s, one);
+        offset[k] = (long) s[1] * src_line_length + (long) s[0] * channels;
+    }
+    const unsigned char* corner = src + offset[0];
+    long step_x = offset[1] - offset[0], step_y = offset[2] - offset[0];
+
+    if (step_x == channels) {
+        for (int y = 0; y < size[1]; y++)
+            memcpy(dst + (size_t) y * dst_line_length, corner + y * step_y, (size_t) size[0] * channels);
+        return;
+    }
+    if (step_x == -channels) {
+        fb_rotate_walk_any(corner, step_x, step_y, size[0], size[1], channels, dst, dst_line_length);
+        return;
+    }
+
+    // rows of region are columns of source
+    for (int by = 0; by < size[1]; by += FB_ROTATE_BLOCK)
+        for (int bx = 0; bx < size[0]; bx += FB_ROTATE_BLOCK) {
+            int bw = size[0] - bx < FB_ROTATE_BLOCK ? size[0] - bx : FB_ROTATE_BLOCK;
+            int bh = size[1] - by < FB_ROTATE_BLOCK ? size[1] - by : FB_ROTATE_BLOCK;
+            const unsigned char* from = corner + by * step_y + bx * step_x;
+            unsigned char* to = dst + (size_t) by * dst_line_length + bx * channels;
+#ifdef __SSE2__
+            if (channels == 4) {
+                int tw = bw & ~3, th = bh & ~3;
+                for (int ty = 0; ty < th; ty += 4)
+                    for (int tx = 0; tx < tw; tx += 4)
+                        fb_rotate_tile4(from + ty * step_y + tx * step_x, step_x, step_y,
+                                        to + (size_t) ty * dst_line_length + tx * 4, dst_line_length);
+                // right and bottom edge of block which don't make whole tiles
+                fb_rotate_walk(from + tw * step_x, step_x, step_y, bw - tw, th, 4,
+                               to + tw * 4, dst_line_length);
+                fb_rotate_walk(from + th * step_y, step_x, step_y, bw, bh - th, 4,
+                               to + (size_t) th * dst_line_length, dst_line_length);
+                continue;
+            }
+#endif
+            fb_rotate_walk_any(from, step_x, step_y, bw, bh, channels, to, dst_line_length);
+        }
+}
+
+#endif
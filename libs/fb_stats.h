@@ -0,0 +1,291 @@
+/* fb_stats - Timing of program stages and trace export
+ *
+ * Do this:
+ *   #define FB_STATS_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Stage is a named span of wall time, opened with stats_begin and closed
+ * with stats_end, possibly with number of bytes it moved. Spans may nest,
+ * summary shows them indented under the span they run in. When stats are
+ * disabled begin and end only check a flag, so calls can stay in hot paths.
+ * Trace is written in Chrome trace-event format (complete "X" events),
+ * which Perfetto and chrome://tracing open.
+ * Page faults (minor and major, whole process) are counted for every span,
+ * they show cost of touching freshly allocated or mapped memory.
+ * With hardware counters on, cycles, instructions, last level cache and
+ * data TLB misses (user space, this process and threads it starts later)
+ * are read at both ends of every span, giving IPC and bytes per cycle.
+ * Low IPC with many LLC misses means a stage waits on memory.
+ */
+
+#ifndef FB_STATS_H
+#define FB_STATS_H
+
+#include <stdio.h>
+
+#define STATS_FIRST_SPANS 64 // spans array grows from this many
+
+enum {
+    STATS_CYCLES, STATS_INSTRUCTIONS, STATS_LLC_MISSES, STATS_DTLB_MISSES, STATS_COUNTERS
+};
+
+typedef struct {
+    const char* name;
+    double start, end;      // seconds since stats_init
+    int depth;              // number of spans open when it began
+    long bytes;             // bytes moved, 0 if not counted
+    long faults;            // page faults during span
+    double counters[STATS_COUNTERS]; // counted during span, with hardware counters on
+} stats_span;
+
+typedef struct {
+    int enabled;
+    double origin;          // CLOCK_MONOTONIC seconds at stats_init
+    int depth;
+    stats_span* spans;
+    int span_count, span_capacity;
+    int dropped;            // spans not recorded for lack of memory
+    int hw;                 // hardware counters are read
+    int counter_fds[STATS_COUNTERS]; // -1 for counters CPU doesn't have
+} fb_stats;
+
+// Start measuring, *enabled* 0 makes all other calls no-ops
+void stats_init(fb_stats* stats, int enabled);
+
+// Start hardware counters. Returns 0 if at least cycles can be counted,
+// -1 otherwise (errno tells why, e.g. no PMU in VM or perf_event_paranoid).
+int stats_enable_hw(fb_stats* stats);
+
+// Open span *name* (string must outlive stats). Returns its id, -1 when disabled or out of memory.
+int stats_begin(fb_stats* stats, const char* name);
+
+// Close span *id* which moved *bytes* bytes
+void stats_end(fb_stats* stats, int id, long bytes);
+
+// Print per-stage breakdown with bytes moved and peak RSS to *out*
+void stats_print(const fb_stats* stats, FILE* out);
+
+// Write spans as Chrome trace events to *path*. Returns 0 on success.
+int stats_write_trace(const fb_stats* stats, const char* path);
+
+// Release spans and hardware counters
+void stats_free(fb_stats* stats);
+
+#endif
+
+#ifdef FB_STATS_IMPLEMENTATION
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>         // getpid, syscall
+#include <sys/resource.h>   // getrusage
+#include <sys/syscall.h>    // SYS_perf_event_open
+#include <linux/perf_event.h>
+
+static long stats_faults(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1)
+        return 0;
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+static double stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void stats_init(fb_stats* stats, int enabled) {
+    stats->enabled = enabled;
+    stats->origin = stats_now();
+    stats->depth = 0;
+    stats->spans = NULL;
+    stats->span_count = 0;
+    stats->span_capacity = 0;
+    stats->dropped = 0;
+    stats->hw = 0;
+    for (int i = 0; i < STATS_COUNTERS; i++)
+        stats->counter_fds[i] = -1;
+}
+
+int stats_enable_hw(fb_stats* stats) {
+    static const struct { unsigned int type; unsigned long long config; } events[STATS_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8
+                             | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8
+                             | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    };
+    int error = 0;
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        // counters aren't grouped, inherited counters can't be read as group;
+        // times allow scaling when they share PMU
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        stats->counter_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (stats->counter_fds[i] == -1 && i == STATS_CYCLES)
+            error = errno;
+    }
+    if (stats->counter_fds[STATS_CYCLES] == -1) {
+        for (int i = 0; i < STATS_COUNTERS; i++)
+            if (stats->counter_fds[i] != -1) {
+                close(stats->counter_fds[i]);
+                stats->counter_fds[i] = -1;
+            }
+        errno = error;
+        return -1;
+    }
+    stats->hw = 1;
+    return 0;
+}
+
+// Read all counters into *values*, scaled for time they weren't running
+static void stats_read_counters(const fb_stats* stats, double* values) {
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        unsigned long long data[3];   // value, time enabled, time running
+        values[i] = 0;
+        if (stats->counter_fds[i] == -1 || read(stats->counter_fds[i], data, sizeof(data)) != sizeof(data))
+            continue;
+        values[i] = data[2] > 0 ? (double) data[0] * data[1] / data[2] : 0;
+    }
+}
+
+int stats_begin(fb_stats* stats, const char* name) {
+    if (!stats->enabled)
+        return -1;
+    if (stats->span_count == stats->span_capacity) {
+        int capacity = stats->span_capacity > 0 ? stats->span_capacity * 2 : STATS_FIRST_SPANS;
+        stats_span* spans = realloc(stats->spans, capacity * sizeof(*spans));
+        if (spans == NULL) {
+            stats->dropped++;
+            return -1;
+        }
+        stats->spans = spans;
+        stats->span_capacity = capacity;
+    }
+    stats_span* span = &stats->spans[stats->span_count];
+    span->name = name;
+    span->depth = stats->depth++;
+    span->bytes = 0;
+    span->faults = stats_faults();
+    span->start = stats_now() - stats->origin;
+    span->end = span->start;
+    if (stats->hw)
+        stats_read_counters(stats, span->counters);
+    return stats->span_count++;
+}
+
+void stats_end(fb_stats* stats, int id, long bytes) {
+    if (id < 0)
+        return;
+    stats_span* span = &stats->spans[id];
+    if (stats->hw) {
+        double now[STATS_COUNTERS];
+        stats_read_counters(stats, now);
+        for (int i = 0; i < STATS_COUNTERS; i++)
+            span->counters[i] = now[i] - span->counters[i];
+    }
+    span->end = stats_now() - stats->origin;
+    span->bytes = bytes;
+    span->faults = stats_faults() - span->faults;
+    stats->depth--;
+}
+
+// Print counters of *span*, "-" for those CPU doesn't have
+static void stats_print_counters(const fb_stats* stats, const stats_span* span, FILE* out) {
+    const double* counters = span->counters;
+    double cycles = counters[STATS_CYCLES];
+    fprintf(out, " %11.0f", cycles);
+    if (stats->counter_fds[STATS_INSTRUCTIONS] != -1 && cycles > 0)
+        fprintf(out, " %5.2f", counters[STATS_INSTRUCTIONS] / cycles);
+    else
+        fprintf(out, " %5s", "-");
+    if (span->bytes > 0 && cycles > 0)
+        fprintf(out, " %8.3f", span->bytes / cycles);
+    else
+        fprintf(out, " %8s", "-");
+    for (int i = STATS_LLC_MISSES; i <= STATS_DTLB_MISSES; i++) {
+        if (stats->counter_fds[i] != -1)
+            fprintf(out, " %9.0f", counters[i]);
+        else
+            fprintf(out, " %9s", "-");
+    }
+}
+
+void stats_print(const fb_stats* stats, FILE* out) {
+    double total = stats_now() - stats->origin;
+    long moved = 0;
+    fprintf(out, "stage                     ms      %%     bytes   faults%s\n",
+            stats->hw ? "      cycles   IPC  B/cycle  LLC-miss  dTLB-miss" : "");
+    for (int i = 0; i < stats->span_count; i++) {
+        const stats_span* span = &stats->spans[i];
+        double ms = (span->end - span->start) * 1e3;
+        fprintf(out, "%*s%-*s %9.3f %6.1f", span->depth * 2, "", 20 - span->depth * 2, span->name,
+                ms, ms / (total * 1e3) * 100);
+        if (span->bytes > 0)
+            fprintf(out, " %9ld", span->bytes);
+        else
+            fprintf(out, " %9s", "");
+        fprintf(out, " %8ld", span->faults);
+        if (stats->hw)
+            stats_print_counters(stats, span, out);
+        fputc('\n', out);
+        // nested spans are counted in their parent
+        if (span->depth == 0)
+            moved += span->bytes;
+    }
+    fprintf(out, "%-20s %9.3f\n", "total", total * 1e3);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        fprintf(out, "bytes moved %ld, peak RSS %ld kB, page faults %ld\n", moved, usage.ru_maxrss,
+                usage.ru_minflt + usage.ru_majflt);
+    if (stats->dropped > 0)
+        fprintf(out, "%d stage(s) not recorded, out of memory\n", stats->dropped);
+}
+
+int stats_write_trace(const fb_stats* stats, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+    int pid = getpid();
+    fprintf(file, "{\"traceEvents\": [\n");
+    for (int i = 0; i < stats->span_count; i++) {
+        const stats_span* span = &stats->spans[i];
+        fprintf(file, "  {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, "
+                      "\"args\": {\"bytes\": %ld, \"faults\": %ld",
+                span->name, span->start * 1e6, (span->end - span->start) * 1e6, pid, pid, span->bytes, span->faults);
+        if (stats->hw)
+            fprintf(file, ", \"cycles\": %.0f, \"instructions\": %.0f, \"llc_misses\": %.0f, \"dtlb_misses\": %.0f",
+                    span->counters[STATS_CYCLES], span->counters[STATS_INSTRUCTIONS],
+                    span->counters[STATS_LLC_MISSES], span->counters[STATS_DTLB_MISSES]);
+        fprintf(file, "}}%s\n", i + 1 < stats->span_count ? "," : "");
+    }
+    fprintf(file, "], \"displayTimeUnit\": \"ms\"}\n");
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    return failed ? -1 : 0;
+}
+
+void stats_free(fb_stats* stats) {
+    free(stats->spans);
+    stats->spans = NULL;
+    stats->span_count = stats->span_capacity = 0;
+    for (int i = 0; i < STATS_COUNTERS; i++)
+        if (stats->counter_fds[i] != -1) {
+            close(stats->counter_fds[i]);
+            stats->counter_fds[i] = -1;
+        }
+    stats->hw = 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/* fb_virtual - Framebuffer kept in plain file or memory
+ *
+ * Do this:
+ *   #define FB_VIRTUAL_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Screen info which driver would report is made up from geometry and
+ * pixel format given by user, e.g. "1920x1080:xrgb8888", and pixels live
+ * in a regular file or in anonymous memory file (memfd). Lets whole
+ * drawing pipeline run on machines without /dev/fb0.
+ */
+
+#ifndef FB_VIRTUAL_H
+#define FB_VIRTUAL_H
+
+#include <linux/fb.h>
+
+typedef struct {
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+} fb_virtual;
+
+// Names of pixel formats accepted by fb_virtual_parse, separated by ", "
+extern const char fb_virtual_formats[];
+
+// Parse "<width>x<height>[:<format>]" into *virt* (format defaults to xrgb8888).
+// Returns 0 on success.
+int fb_virtual_parse(const char* spec, fb_virtual* virt);
+
+// Open storage for pixels of *virt*: file at *path*, created or resized
+// as needed, or memfd when *path* is NULL. Returns file descriptor or -1.
+int fb_virtual_open(const char* path, const fb_virtual* virt);
+
+#endif
+
+#ifdef FB_VIRTUAL_IMPLEMENTATION
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>      // open
+#include <unistd.h>     // ftruncate, close
+#include <sys/mman.h>   // memfd_create
+
+typedef struct {
+    const char* name;
+    int bits_per_pixel;
+    int visual;
+    int offset[3];      // red, green, blue
+    int length[3];
+} fb_virtual_format;
+
+static const fb_virtual_format fb_virtual_format_list[] = {
+    {"xrgb8888", 32, FB_VISUAL_TRUECOLOR, {16, 8, 0}, {8, 8, 8}},
+    {"xbgr8888", 32, FB_VISUAL_TRUECOLOR, {0, 8, 16}, {8, 8, 8}},
+    {"rgb888",   24, FB_VISUAL_TRUECOLOR, {16, 8, 0}, {8, 8, 8}},
+    {"rgb565",   16, FB_VISUAL_TRUECOLOR, {11, 5, 0}, {5, 6, 5}},
+    {"xrgb1555", 16, FB_VISUAL_TRUECOLOR, {10, 5, 0}, {5, 5, 5}},
+    {"pal8",      8, FB_VISUAL_PSEUDOCOLOR, {0, 0, 0}, {8, 8, 8}},
+};
+
+const char fb_virtual_formats[] = "xrgb8888, xbgr8888, rgb888, rgb565, xrgb1555, pal8";
+
+int fb_virtual_parse(const char* spec, fb_virtual* virt) {
+    int width, height, end = 0;
+    if (sscanf(spec, "%dx%d%n", &width, &height, &end) != 2 || width <= 0 || height <= 0
+            || width > 32768 || height > 32768)
+        return -1;
+    const char* name = "xrgb8888";
+    if (spec[end] == ':')
+        name = spec + end + 1;
+    else if (spec[end] != '\0')
+        return -1;
+
+    const fb_virtual_format* format = NULL;
+    for (size_t i = 0; i < sizeof(fb_virtual_format_list) / sizeof(fb_virtual_format_list[0]); i++)
+        if (strcmp(fb_virtual_format_list[i].name, name) == 0)
+            format = &fb_virtual_format_list[i];
+    if (format == NULL)
+        return -1;
+
+    memset(virt, 0, sizeof(*virt));
+    struct fb_var_screeninfo* vinfo = &virt->vinfo;
+    vinfo->xres = vinfo->xres_virtual = width;
+    vinfo->yres = vinfo->yres_virtual = height;
+    vinfo->bits_per_pixel = format->bits_per_pixel;
+    vinfo->red.offset = format->offset[0];
+    vinfo->green.offset = format->offset[1];
+    vinfo->blue.offset = format->offset[2];
+    vinfo->red.length = format->length[0];
+    vinfo->green.length = format->length[1];
+    vinfo->blue.length = format->length[2];
+
+    struct fb_fix_screeninfo* finfo = &virt->finfo;
+    snprintf(finfo->id, sizeof(finfo->id), "virtual");
+    finfo->type = FB_TYPE_PACKED_PIXELS;
+    finfo->visual = format->visual;
+    finfo->line_length = width * format->bits_per_pixel / 8;
+    finfo->smem_len = finfo->line_length * height;
+    return 0;
+}
+
+int fb_virtual_open(const char* path, const fb_virtual* virt) {
+    int fd = path != NULL ? open(path, O_RDWR | O_CREAT, 0644) : memfd_create("fbtty-virtual", 0);
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, virt->finfo.smem_len) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif
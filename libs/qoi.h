@@ -0,0 +1,205 @@
+/* qoi - Decoder and encoder of QOI ("Quite OK Image") format
+ *
+ * Do this:
+ *   #define QOI_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * QOI is lossless like PNG, but every pixel is coded in one pass by
+ * a handful of byte-aligned operations (run, index into 64 recent colors,
+ * small difference, full value), without entropy coding, so it decodes
+ * several times faster than PNG inflates. Images are 8-bit RGB or RGBA,
+ * see https://qoiformat.org/qoi-specification.pdf
+ */
+
+#ifndef QOI_H
+#define QOI_H
+
+#include <stddef.h>
+
+// Check if *file* of *size* bytes is QOI image and get its size and
+// channels (3 or 4). Returns 1 if it is.
+int qoi_info(const unsigned char* file, size_t size, int* width, int* height, int* channels);
+
+// Decode QOI image into *out* of width * height * *req_channels* bytes
+// (3 drops alpha, 4 makes RGB opaque). Returns 0 on success, -1 if data is
+// cut short, in which case rest of *out* is left as it was.
+int qoi_decode(const unsigned char* file, size_t size, unsigned char* out, int req_channels);
+
+// Encode *width* x *height* image of *channels* (3 or 4) with rows of
+// width * channels bytes to *path*. Returns 0 on success.
+int qoi_write(const char* path, const unsigned char* pixels, int width, int height, int channels);
+
+#endif
+
+#ifdef QOI_IMPLEMENTATION
+#include <stdio.h>
+#include <string.h>
+
+#define QOI_HEADER 14
+#define QOI_OP_INDEX 0x00   // 2-bit tags
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xC0
+#define QOI_OP_RGB   0xFE   // 8-bit tags
+#define QOI_OP_RGBA  0xFF
+#define QOI_MASK     0xC0
+
+static const unsigned char qoi_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+static unsigned int qoi_get32(const unsigned char* bytes) {
+    return (unsigned int) bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+static int qoi_hash(const unsigned char* px) {
+    return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+int qoi_info(const unsigned char* file, size_t size, int* width, int* height, int* channels) {
+    if (size < QOI_HEADER || memcmp(file, "qoif", 4) != 0)
+        return 0;
+    unsigned int w = qoi_get32(file + 4), h = qoi_get32(file + 8);
+    // same limit as stb_image puts on other formats
+    if (w == 0 || h == 0 || w > 1 << 24 || h > 1 << 24 || (file[12] != 3 && file[12] != 4))
+        return 0;
+    *width = w;
+    *height = h;
+    *channels = file[12];
+    return 1;
+}
+
+int qoi_decode(const unsigned char* file, size_t size, unsigned char* out, int req_channels) {
+    int width, height, channels;
+    if (!qoi_info(file, size, &width, &height, &channels) || size < QOI_HEADER + sizeof(qoi_padding))
+        return -1;
+    unsigned char index[64][4];
+    memset(index, 0, sizeof(index));
+    unsigned char px[4] = {0, 0, 0, 255};
+    const unsigned char* in = file + QOI_HEADER;
+    // chunks are never read into padding at the end
+    const unsigned char* end = file + size - sizeof(qoi_padding);
+    size_t pixels = (size_t) width * height;
+    int run = 0;
+
+    for (size_t i = 0; i < pixels; i++, out += req_channels) {
+        if (run > 0) {
+            run--;
+        } else {
+            if (in >= end)
+                return -1;
+            int b1 = *in++;
+            if (b1 == QOI_OP_RGB) {
+                if (end - in < 3)
+                    return -1;
+                memcpy(px, in, 3);
+                in += 3;
+            } else if (b1 == QOI_OP_RGBA) {
+                if (end - in < 4)
+                    return -1;
+                memcpy(px, in, 4);
+                in += 4;
+            } else if ((b1 & QOI_MASK) == QOI_OP_INDEX) {
+                memcpy(px, index[b1], 4);
+            } else if ((b1 & QOI_MASK) == QOI_OP_DIFF) {
+                px[0] += ((b1 >> 4) & 3) - 2;
+                px[1] += ((b1 >> 2) & 3) - 2;
+                px[2] += (b1 & 3) - 2;
+            } else if ((b1 & QOI_MASK) == QOI_OP_LUMA) {
+                if (in >= end)
+                    return -1;
+                int b2 = *in++;
+                int dg = (b1 & 0x3F) - 32;
+                px[0] += dg - 8 + ((b2 >> 4) & 0x0F);
+                px[1] += dg;
+                px[2] += dg - 8 + (b2 & 0x0F);
+            } else {
+                run = b1 & 0x3F;
+            }
+            memcpy(index[qoi_hash(px)], px, 4);
+        }
+        out[0] = px[0];
+        out[1] = px[1];
+        out[2] = px[2];
+        if (req_channels == 4)
+            out[3] = px[3];
+    }
+    return 0;
+}
+
+int qoi_write(const char* path, const unsigned char* pixels, int width, int height, int channels) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return -1;
+    // chunks are gathered in buffer, flushed when next one might not fit
+    unsigned char buffer[65536];
+    unsigned char* out = buffer;
+    unsigned char* flush_at = buffer + sizeof(buffer) - 5;
+    memcpy(out, "qoif", 4);
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = (unsigned int) width >> (24 - i*8);
+        out[8 + i] = (unsigned int) height >> (24 - i*8);
+    }
+    out[12] = channels;
+    out[13] = 0;    // sRGB with linear alpha
+    out += QOI_HEADER;
+
+    unsigned char index[64][4];
+    memset(index, 0, sizeof(index));
+    unsigned char prev[4] = {0, 0, 0, 255};
+    unsigned char px[4] = {0, 0, 0, 255};
+    size_t count = (size_t) width * height;
+    int run = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (out >= flush_at) {
+            fwrite(buffer, 1, out - buffer, file);
+            out = buffer;
+        }
+        memcpy(px, pixels + i * channels, channels);
+        if (memcmp(px, prev, 4) == 0) {
+            run++;
+            if (run == 62 || i == count - 1) {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *out++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+        int hash = qoi_hash(px);
+        if (memcmp(index[hash], px, 4) == 0) {
+            *out++ = QOI_OP_INDEX | hash;
+        } else {
+            memcpy(index[hash], px, 4);
+            if (px[3] == prev[3]) {
+                signed char dr = px[0] - prev[0], dg = px[1] - prev[1], db = px[2] - prev[2];
+                signed char dr_dg = dr - dg, db_dg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    *out++ = QOI_OP_LUMA | (dg + 32);
+                    *out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+                } else {
+                    *out++ = QOI_OP_RGB;
+                    memcpy(out, px, 3);
+                    out += 3;
+                }
+            } else {
+                *out++ = QOI_OP_RGBA;
+                memcpy(out, px, 4);
+                out += 4;
+            }
+        }
+        memcpy(prev, px, 4);
+    }
+    fwrite(buffer, 1, out - buffer, file);
+    fwrite(qoi_padding, 1, sizeof(qoi_padding), file);
+
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    if (failed)
+        remove(path);
+    return failed ? -1 : 0;
+}
+
+#endif
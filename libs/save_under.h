@@ -0,0 +1,138 @@
+/* save_under - Keep framebuffer region covered by image to restore it later
+ *
+ * Do this:
+ *   #define SAVE_UNDER_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Needs tty_cache.h (fbtty_runtime_dir) to be included before.
+ * Region is stored in runtime directory (tmpfs) as small header followed
+ * by rows of framebuffer pixels without padding.
+ */
+
+#ifndef SAVE_UNDER_H
+#define SAVE_UNDER_H
+
+typedef struct {
+    char magic[8];      // "FBTYSAV1"
+    int pos_px[2];      // left-top corner in framebuffer pixels
+    int row_bytes;      // bytes in one saved row
+    int height;         // number of saved rows
+    int bytes_per_pixel;
+} save_under_header;
+
+// Put path of region saved under *id* into *path*.
+// Returns -1 if *id* has characters other than letters, digits, '-' and '_'.
+int save_under_path(const char* id, char* path, int len);
+
+// Save *height* rows of *row_bytes* bytes starting at *fb_loc*.
+// Returns 0 on success.
+int save_under_store(const char* path, const unsigned char* fb_loc, int fb_line_length,
+                     const int* pos_px, int bytes_per_pixel, int row_bytes, int height);
+
+// Copy saved region back to framebuffer with *bytes_per_pixel* bytes per pixel
+// and remove it. Returns 0 on success, -1 if region is missing, was saved in
+// other pixel format or its rows don't fit in lines of screen.
+int save_under_restore(const char* path, unsigned char* fb_ptr, int fb_line_length, long screen_size,
+                       int bytes_per_pixel);
+
+#endif
+
+#ifdef SAVE_UNDER_IMPLEMENTATION
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>    // open
+#include <unistd.h>   // write, close
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+
+static const char save_under_magic[8] = {'F', 'B', 'T', 'Y', 'S', 'A', 'V', '1'};
+
+int save_under_path(const char* id, char* path, int len) {
+    if (*id == '\0')
+        return -1;
+    for (const char* c = id; *c; c++) {
+        int allowed = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z')
+                   || (*c >= '0' && *c <= '9') || *c == '-' || *c == '_';
+        if (!allowed)
+            return -1;
+    }
+
+    char dir[200];
+    if (fbtty_runtime_dir(dir, sizeof(dir)) == -1)
+        return -1;
+    snprintf(path, len, "%s/%s.under", dir, id);
+    return 0;
+}
+
+int save_under_store(const char* path, const unsigned char* fb_loc, int fb_line_length,
+                     const int* pos_px, int bytes_per_pixel, int row_bytes, int height) {
+    save_under_header header;
+    memcpy(header.magic, save_under_magic, sizeof(header.magic));
+    header.pos_px[0] = pos_px[0];
+    header.pos_px[1] = pos_px[1];
+    header.row_bytes = row_bytes;
+    header.height = height;
+    header.bytes_per_pixel = bytes_per_pixel;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return -1;
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    for (int y = 0; y < height && !failed; y++)
+        failed = fwrite(fb_loc + y * fb_line_length, row_bytes, 1, file) != 1;
+    failed |= fclose(file) != 0;
+
+    if (failed)
+        remove(path);
+    return failed ? -1 : 0;
+}
+
+int save_under_restore(const char* path, unsigned char* fb_ptr, int fb_line_length, long screen_size,
+                       int bytes_per_pixel) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    save_under_header header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, save_under_magic, sizeof(header.magic)) != 0
+            || header.row_bytes <= 0 || header.height <= 0) {
+        close(fd);
+        return -1;
+    }
+    // after mode change pixels would be garbage, or rows would wrap across lines
+    if (header.bytes_per_pixel != bytes_per_pixel || header.row_bytes % bytes_per_pixel != 0
+            || header.pos_px[0] < 0 || header.pos_px[1] < 0
+            || (long) header.pos_px[0] * bytes_per_pixel + header.row_bytes > fb_line_length) {
+        close(fd);
+        return -1;
+    }
+
+    long first = (long) header.pos_px[1] * fb_line_length + (long) header.pos_px[0] * bytes_per_pixel;
+    long last = first + (long) (header.height-1) * fb_line_length + header.row_bytes;
+    if (last > screen_size) {
+        close(fd);
+        return -1;
+    }
+
+    size_t map_size = sizeof(header) + (size_t) header.row_bytes * header.height;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < map_size) {
+        close(fd);
+        return -1;
+    }
+    unsigned char* saved = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (saved == MAP_FAILED)
+        return -1;
+
+    const unsigned char* rows = saved + sizeof(header);
+    for (int y = 0; y < header.height; y++)
+        memcpy(fb_ptr + first + (long) y * fb_line_length, rows + (size_t) y * header.row_bytes, header.row_bytes);
+
+    munmap(saved, map_size);
+    remove(path);
+    return 0;
+}
+
+#endif
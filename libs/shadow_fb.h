@@ -0,0 +1,108 @@
+/* shadow_fb - Copy of framebuffer region kept in system RAM
+ *
+ * Do this:
+ *   #define SHADOW_FB_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Needs fb_blit.h (stream_copy) to be included before.
+ * Framebuffer memory is uncached, so reading it is very slow. Everything
+ * which needs to know screen content works on shadow instead and only
+ * dirty spans of rows are written to device, with streaming stores.
+ */
+
+#ifndef SHADOW_FB_H
+#define SHADOW_FB_H
+
+typedef struct {
+    unsigned char* pixels;  // region in framebuffer pixel format
+    int pos_px[2];          // left-top corner of region on screen
+    int size[2];            // size of region in pixels
+    int bytes_per_pixel;
+    int line_length;        // length of shadow line in bytes
+    int* dirty;             // per row: first and last+1 dirty byte, -1 if clean
+} shadow_fb;
+
+// Allocate shadow of *size* region at *pos_px*, contents undefined and clean.
+// Returns 0 on success.
+int shadow_fb_init(shadow_fb* shadow, const int* pos_px, const int* size, int bytes_per_pixel);
+
+void shadow_fb_free(shadow_fb* shadow);
+
+// Read region from framebuffer into shadow. It's the only read of device
+// memory, do it once and keep shadow up to date afterwards.
+void shadow_fb_load(shadow_fb* shadow, const unsigned char* fb_ptr, int fb_line_length);
+
+// Mark pixels [x, x+width) of rows [y, y+height) as changed in shadow.
+void shadow_fb_mark(shadow_fb* shadow, int x, int y, int width, int height);
+
+// Write dirty spans to framebuffer and mark shadow clean.
+void shadow_fb_flush(shadow_fb* shadow, unsigned char* fb_ptr, int fb_line_length);
+
+#endif
+
+#ifdef SHADOW_FB_IMPLEMENTATION
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcpy
+
+int shadow_fb_init(shadow_fb* shadow, const int* pos_px, const int* size, int bytes_per_pixel) {
+    shadow->pos_px[0] = pos_px[0];
+    shadow->pos_px[1] = pos_px[1];
+    shadow->size[0] = size[0];
+    shadow->size[1] = size[1];
+    shadow->bytes_per_pixel = bytes_per_pixel;
+    shadow->line_length = size[0] * bytes_per_pixel;
+    shadow->pixels = malloc((size_t) shadow->line_length * size[1]);
+    shadow->dirty = malloc(sizeof(int) * 2 * size[1]);
+    if (shadow->pixels == NULL || shadow->dirty == NULL) {
+        shadow_fb_free(shadow);
+        return -1;
+    }
+    for (int y = 0; y < size[1]; y++)
+        shadow->dirty[y*2] = shadow->dirty[y*2+1] = -1;
+    return 0;
+}
+
+void shadow_fb_free(shadow_fb* shadow) {
+    free(shadow->pixels);
+    free(shadow->dirty);
+    shadow->pixels = NULL;
+    shadow->dirty = NULL;
+}
+
+// Get address of left-top corner of region in framebuffer
+static unsigned char* shadow_fb_origin(const shadow_fb* shadow, const unsigned char* fb_ptr, int fb_line_length) {
+    return (unsigned char*) fb_ptr + (long) shadow->pos_px[1] * fb_line_length
+                                   + shadow->pos_px[0] * shadow->bytes_per_pixel;
+}
+
+void shadow_fb_load(shadow_fb* shadow, const unsigned char* fb_ptr, int fb_line_length) {
+    const unsigned char* origin = shadow_fb_origin(shadow, fb_ptr, fb_line_length);
+    for (int y = 0; y < shadow->size[1]; y++)
+        memcpy(shadow->pixels + (size_t) y * shadow->line_length,
+               origin + (long) y * fb_line_length, shadow->line_length);
+}
+
+void shadow_fb_mark(shadow_fb* shadow, int x, int y, int width, int height) {
+    int begin = x * shadow->bytes_per_pixel;
+    int end = (x + width) * shadow->bytes_per_pixel;
+    for (int row = y; row < y + height; row++) {
+        int* span = shadow->dirty + row*2;
+        if (span[0] == -1 || begin < span[0]) span[0] = begin;
+        if (span[1] == -1 || end > span[1])   span[1] = end;
+    }
+}
+
+void shadow_fb_flush(shadow_fb* shadow, unsigned char* fb_ptr, int fb_line_length) {
+    unsigned char* origin = shadow_fb_origin(shadow, fb_ptr, fb_line_length);
+    for (int y = 0; y < shadow->size[1]; y++) {
+        int* span = shadow->dirty + y*2;
+        if (span[0] == -1)
+            continue;
+        stream_copy(origin + (long) y * fb_line_length + span[0],
+                    shadow->pixels + (size_t) y * shadow->line_length + span[0], span[1] - span[0]);
+        span[0] = span[1] = -1;
+    }
+    store_fence();
+}
+
+#endif
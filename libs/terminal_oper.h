@@ -13,10 +13,20 @@
 #include <string.h> // strcmp
 #include <termios.h>
 #include <unistd.h> // read, write
+#include <poll.h>   // poll
+#include <sys/ioctl.h> // ioctl, TIOCGWINSZ
+#include <linux/kd.h>  // KDFONTOP
 
-// Get size (lines, columns) in chars
+// Get size (width, height) of character cell in pixels.
+// Tries tty pixel size, console font and CSI 16 t query before
+// falling back to 8x16.
 void get_cell_size(int* size);
 
+// Write *query* to terminal and read reply into *reply* (at most *len* - 1
+// bytes, null terminated). Gives up after *timeout_ms*.
+// Returns number of bytes read or -1 when terminal didn't answer.
+int query_terminal(const char* query, char* reply, int len, int timeout_ms);
+
 // Get left-top offset (lines, columns) of current terminal (pane)
 // Usually 0 0 but in tmux it should be adjusted for pane.
 void get_tty_offset(int* offset);
@@ -24,30 +34,82 @@ void get_tty_offset(int* offset);
 // Get size in pixels
 void get_screen_size(int* size);
 
-// Get cursor position relative to pane
+// Get cursor position relative to pane, (1, 1) when terminal doesn't answer
 void get_cursor_pos(int* position);
 
 // Sets cursor to *pos[0]* column and *pos[1]* line index
-// relative to pane (e.g. tmux starts from (0, 0) for each pane)
+// relative to pane (e.g. tmux starts from (0, 0) for each pane).
+// Does nothing when output isn't a terminal.
 void set_cursor_pos(const int* position);
 
 #endif
 
 #ifdef TERMINAL_OPER_IMPLEMENTATION
+int query_terminal(const char* query, char* reply, int len, int timeout_ms) {
+    struct termios tty, oldtty;
+    if (tcgetattr(STDIN_FILENO, &oldtty) == -1)
+        return -1;
+    tty = oldtty;
+    tty.c_lflag &= ~(ICANON|ECHO);
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &tty);
+    write(STDOUT_FILENO, query, strlen(query));
+
+    int got = -1;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+        got = read(STDIN_FILENO, reply, len-1);
+        if (got >= 0) reply[got] = '\0';
+    }
+
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldtty);
+    return got;
+}
+
 void get_cell_size(int* size) {
-    //TODO
+    // pixel size reported by terminal emulator
+    struct winsize winfo;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &winfo) == 0
+            && winfo.ws_xpixel > 0 && winfo.ws_col > 0 && winfo.ws_ypixel > 0 && winfo.ws_row > 0) {
+        size[0] = winfo.ws_xpixel / winfo.ws_col;
+        size[1] = winfo.ws_ypixel / winfo.ws_row;
+        return;
+    }
+
+    // font of linux virtual console
+    // kernel refuses fonts bigger than given limits (ENOSPC), so they are the largest
+    // it supports, like kbd's getfont does; NULL data asks for size only
+    struct console_font_op font = {KD_FONT_OP_GET, 0, 32, 32, 512, NULL};
+    if (ioctl(STDIN_FILENO, KDFONTOP, &font) == 0 && font.width > 0 && font.height > 0) {
+        size[0] = font.width;
+        size[1] = font.height;
+        return;
+    }
+
+    // ask terminal, reply is CSI 6 ; height ; width t
+    char reply[32];
+    int height, width;
+    if (query_terminal("\033[16t", reply, sizeof(reply), 100) > 0
+            && sscanf(reply, "\033[6;%d;%dt", &height, &width) == 2) {
+        size[0] = width;
+        size[1] = height;
+        return;
+    }
+
     size[0] = 8;
     size[1] = 16;
 }
 
 void get_tty_offset(int* offset) {
+    offset[0] = 0;
+    offset[1] = 0;
     if (getenv("TMUX") != NULL) {
         FILE* out = popen("tmux display -p \"#{pane_left} #{pane_top}\"", "r");
-        fscanf(out, "%d%d", &offset[0], &offset[1]);
+        if (out == NULL)
+            return;
+        if (fscanf(out, "%d%d", &offset[0], &offset[1]) != 2)
+            offset[0] = offset[1] = 0;
         pclose(out);
-    } else {
-        offset[0] = 0;
-        offset[1] = 0;
     }
 }
 
@@ -59,22 +121,21 @@ void get_screen_size(int* size) {
 }
 
 void get_cursor_pos(int* position) {
-    struct termios tty, oldtty;
-    tcgetattr(STDIN_FILENO, &oldtty);
-    tcgetattr(STDIN_FILENO, &tty); 
-    tty.c_lflag &= ~(ICANON|ECHO); 
-
-    tcsetattr(STDIN_FILENO, TCSANOW, &tty); 
-    write(STDOUT_FILENO, "\033[6n", 5);
-    
-    char code_ret[32] = {0};
-    read(STDIN_FILENO, &code_ret, 32);
-    sscanf(code_ret, "\033[%d;%dR", &position[1], &position[0]);
-
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldtty);
+    // left-top corner when there is no terminal to answer
+    position[0] = 1;
+    position[1] = 1;
+    char reply[32];
+    int line, column;
+    if (query_terminal("\033[6n", reply, sizeof(reply), 1000) > 0
+            && sscanf(reply, "\033[%d;%dR", &line, &column) == 2) {
+        position[0] = column;
+        position[1] = line;
+    }
 }
 
 void set_cursor_pos(const int* position) {
+    if (!isatty(STDOUT_FILENO))
+        return;
     char command[255];
     sprintf(command, "tput cup %d %d", position[1], position[0]);
     system(command);
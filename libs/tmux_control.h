@@ -0,0 +1,205 @@
+/* tmux_control - Client of tmux control mode (tmux -C)
+ *
+ * Do this:
+ *   #define TMUX_CONTROL_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Attaches read-only to session of current pane and delivers
+ * notifications (%layout-change, %window-pane-changed, ...) line by line.
+ */
+
+#ifndef TMUX_CONTROL_H
+#define TMUX_CONTROL_H
+
+#include <stdio.h>
+#include <sys/types.h> // pid_t
+
+typedef struct {
+    pid_t pid;          // pid of tmux client
+    int in_fd;          // commands are written here
+    int out_fd;         // notifications and command replies are read from here
+    int pending;        // notification about layout arrived while waiting for reply
+    char buf[4096];     // bytes read from out_fd but not returned yet
+    int buf_len;
+} tmux_control;
+
+typedef struct {
+    int offset[2];      // left-top corner of pane in columns and lines
+    int size[2];        // size of pane in columns and lines
+    int visible;        // pane is shown (window active and not zoomed-out)
+} tmux_pane_state;
+
+// Attach control client to session of current pane ($TMUX, $TMUX_PANE).
+// Returns 0 on success, -1 when not in tmux or tmux failed to start.
+int tmux_control_open(tmux_control* ctl);
+
+// Read next line sent by tmux into *line*, blocks if no line is buffered.
+// Returns 1 when line is notification which may change pane placement,
+// 0 for other lines and -1 when tmux client exited.
+int tmux_control_read(tmux_control* ctl, char* line, int len);
+
+// Check if whole line is already buffered, so read won't block
+// even when out_fd doesn't poll as readable.
+int tmux_control_buffered(const tmux_control* ctl);
+
+// Ask tmux about placement of current pane.
+// Returns 0 on success, -1 when pane doesn't exist anymore.
+int tmux_control_pane_state(tmux_control* ctl, tmux_pane_state* state);
+
+void tmux_control_close(tmux_control* ctl);
+
+#endif
+
+#ifdef TMUX_CONTROL_IMPLEMENTATION
+#include <stdlib.h>   // getenv
+#include <string.h>
+#include <unistd.h>   // pipe, fork, execlp
+#include <signal.h>   // kill
+#include <sys/wait.h> // waitpid
+
+static int tmux_control_is_layout_event(const char* line);
+
+int tmux_control_open(tmux_control* ctl) {
+    const char* tmux_env = getenv("TMUX");
+    const char* pane = getenv("TMUX_PANE");
+    if (tmux_env == NULL || pane == NULL)
+        return -1;
+
+    // $TMUX is "socket_path,server_pid,session_index"
+    char socket_path[256];
+    snprintf(socket_path, sizeof(socket_path), "%s", tmux_env);
+    char* comma = strchr(socket_path, ',');
+    if (comma != NULL) *comma = '\0';
+
+    int to_tmux[2], from_tmux[2];
+    if (pipe(to_tmux) == -1)
+        return -1;
+    if (pipe(from_tmux) == -1) {
+        close(to_tmux[0]); close(to_tmux[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(to_tmux[0]); close(to_tmux[1]);
+        close(from_tmux[0]); close(from_tmux[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(to_tmux[0], STDIN_FILENO);
+        dup2(from_tmux[1], STDOUT_FILENO);
+        close(to_tmux[0]); close(to_tmux[1]);
+        close(from_tmux[0]); close(from_tmux[1]);
+        // tmux refuses to attach from inside tmux
+        unsetenv("TMUX");
+        execlp("tmux", "tmux", "-C", "-S", socket_path,
+               "attach-session", "-r", "-t", pane, (char*) NULL);
+        _exit(127);
+    }
+
+    close(to_tmux[0]);
+    close(from_tmux[1]);
+    ctl->pid = pid;
+    ctl->in_fd = to_tmux[1];
+    ctl->out_fd = from_tmux[0];
+    ctl->pending = 0;
+    ctl->buf_len = 0;
+
+    // skip reply to attach-session itself
+    char line[512];
+    int ret;
+    while ((ret = tmux_control_read(ctl, line, sizeof(line))) != -1) {
+        if (strncmp(line, "%end", 4) == 0)
+            return 0;
+        if (strncmp(line, "%error", 6) == 0)
+            break;
+    }
+    tmux_control_close(ctl);
+    return -1;
+}
+
+// Check if notification may change where (or whether) pane is shown
+static int tmux_control_is_layout_event(const char* line) {
+    static const char* events[] = {
+        "%layout-change", "%window-pane-changed", "%session-window-changed",
+        "%session-changed", "%client-session-changed", NULL
+    };
+    for (int i = 0; events[i] != NULL; i++)
+        if (strncmp(line, events[i], strlen(events[i])) == 0)
+            return 1;
+    return 0;
+}
+
+int tmux_control_buffered(const tmux_control* ctl) {
+    return memchr(ctl->buf, '\n', ctl->buf_len) != NULL;
+}
+
+int tmux_control_read(tmux_control* ctl, char* line, int len) {
+    char* newline;
+    while ((newline = memchr(ctl->buf, '\n', ctl->buf_len)) == NULL) {
+        if (ctl->buf_len == sizeof(ctl->buf))
+            ctl->buf_len = 0; // drop line longer than buffer
+        int got = read(ctl->out_fd, ctl->buf + ctl->buf_len, sizeof(ctl->buf) - ctl->buf_len);
+        if (got <= 0)
+            return -1;
+        ctl->buf_len += got;
+    }
+
+    int line_len = newline - ctl->buf + 1;
+    int copy_len = line_len < len ? line_len : len-1;
+    memcpy(line, ctl->buf, copy_len);
+    line[copy_len] = '\0';
+    ctl->buf_len -= line_len;
+    memmove(ctl->buf, ctl->buf + line_len, ctl->buf_len);
+
+    if (strncmp(line, "%exit", 5) == 0)
+        return -1;
+    return tmux_control_is_layout_event(line);
+}
+
+int tmux_control_pane_state(tmux_control* ctl, tmux_pane_state* state) {
+    char command[128];
+    int command_len = snprintf(command, sizeof(command),
+        "display -p -t %s \"#{pane_left} #{pane_top} #{pane_width} #{pane_height} "
+        "#{window_active} #{window_zoomed_flag} #{pane_active}\"\n", getenv("TMUX_PANE"));
+    if (write(ctl->in_fd, command, command_len) != command_len)
+        return -1;
+
+    // reply is wrapped in %begin ... %end (or %error), notifications
+    // may come in between
+    char line[512];
+    int in_reply = 0, parsed = 0;
+    int window_active, zoomed, pane_active;
+    while (1) {
+        int ret = tmux_control_read(ctl, line, sizeof(line));
+        if (ret == -1)
+            return -1;
+        if (ret == 1) {
+            ctl->pending = 1;
+            continue;
+        }
+        if (strncmp(line, "%begin", 6) == 0)
+            in_reply = 1;
+        else if (strncmp(line, "%end", 4) == 0 || strncmp(line, "%error", 6) == 0) {
+            if (in_reply) break;
+        }
+        else if (in_reply && sscanf(line, "%d%d%d%d%d%d%d",
+                    &state->offset[0], &state->offset[1], &state->size[0], &state->size[1],
+                    &window_active, &zoomed, &pane_active) == 7)
+            parsed = 1;
+    }
+
+    if (!parsed)
+        return -1;
+    state->visible = window_active && (!zoomed || pane_active);
+    return 0;
+}
+
+void tmux_control_close(tmux_control* ctl) {
+    close(ctl->in_fd);
+    close(ctl->out_fd);
+    kill(ctl->pid, SIGTERM);
+    waitpid(ctl->pid, NULL, 0);
+}
+
+#endif
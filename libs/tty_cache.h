@@ -0,0 +1,119 @@
+/* tty_cache - Per-tty cache of terminal and framebuffer geometry
+ *
+ * Do this:
+ *   #define TTY_CACHE_IMPLEMENTATION
+ * before including this header in one source file.
+ *
+ * Cache file lives in $XDG_RUNTIME_DIR/fbtty (or /run/user/$UID/fbtty)
+ * and is named after the tty. Entry is reused only when its key matches
+ * current key exactly, key is built from cheap ioctls.
+ */
+
+#ifndef TTY_CACHE_H
+#define TTY_CACHE_H
+
+#define TTY_CACHE_VERSION 3
+
+// Values compared to decide whether cache is still valid
+typedef struct {
+    char out_path[64];          // framebuffer device
+    unsigned int fb_geometry[8];// xres, yres, xres_virtual, yres_virtual,
+                                // bits_per_pixel, red/green/blue offset
+    unsigned short winsize[4];  // rows, cols, xpixel, ypixel
+} tty_cache_key;
+
+typedef struct {
+    int version;
+    tty_cache_key key;
+    int line_length;            // framebuffer line length in bytes
+    int cell_size[2];           // size of character cell in pixels
+    int tty_offset[2];          // offset of pane in columns and lines, asked again in tmux
+    int ypanstep;               // framebuffer can pan vertically if > 0
+    int can_vsync;              // FBIO_WAITFORVSYNC works, -1 if not probed yet
+    int visual;                 // FB_VISUAL_* of framebuffer
+} tty_cache;
+
+// Put directory for runtime files of fbtty into *dir* and create it.
+// Returns 0 on success.
+int fbtty_runtime_dir(char* dir, int len);
+
+// Put path of cache file for terminal on stdin into *path*.
+// Returns 0 on success, -1 if stdin isn't tty.
+int tty_cache_path(char* path, int len);
+
+// Read cache from *path*. Returns 0 on success, -1 if missing or stale version.
+int tty_cache_load(const char* path, tty_cache* cache);
+
+// Atomically replace cache at *path*. Returns 0 on success.
+int tty_cache_store(const char* path, const tty_cache* cache);
+
+#endif
+
+#ifdef TTY_CACHE_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>  // getenv
+#include <string.h>
+#include <unistd.h>  // ttyname, getuid
+#include <sys/stat.h> // mkdir
+
+int fbtty_runtime_dir(char* dir, int len) {
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL)
+        snprintf(dir, len, "%s/fbtty", runtime);
+    else
+        snprintf(dir, len, "/run/user/%d/fbtty", (int) getuid());
+
+    if (mkdir(dir, 0700) == -1 && access(dir, W_OK) == -1)
+        return -1;
+    return 0;
+}
+
+int tty_cache_path(char* path, int len) {
+    const char* tty = ttyname(STDIN_FILENO);
+    if (tty == NULL)
+        return -1;
+
+    char dir[200];
+    if (fbtty_runtime_dir(dir, sizeof(dir)) == -1)
+        return -1;
+
+    // /dev/pts/3 -> dev-pts-3
+    char name[64];
+    snprintf(name, sizeof(name), "%s", tty + (tty[0] == '/'));
+    for (char* c = name; *c; c++)
+        if (*c == '/') *c = '-';
+
+    snprintf(path, len, "%s/%s.cache", dir, name);
+    return 0;
+}
+
+int tty_cache_load(const char* path, tty_cache* cache) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+    size_t got = fread(cache, sizeof(*cache), 1, file);
+    fclose(file);
+
+    if (got != 1 || cache->version != TTY_CACHE_VERSION)
+        return -1;
+    return 0;
+}
+
+int tty_cache_store(const char* path, const tty_cache* cache) {
+    char tmp_path[280];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int) getpid());
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL)
+        return -1;
+    size_t put = fwrite(cache, sizeof(*cache), 1, file);
+    fclose(file);
+
+    if (put != 1 || rename(tmp_path, path) == -1) {
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
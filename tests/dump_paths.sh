@@ -0,0 +1,49 @@
+#!/bin/sh
+# Images drawn in bands straight to framebuffer must come out the same as
+# drawn through shadow (kept for --save-under), for every format and dither,
+# and raw images the same as their pixels. QOI images must draw the same
+# as their source and truncated ones must fail.
+# Image read from pipe must come out the same as read from file.
+
+srcdir=${srcdir:-.}
+image=$srcdir/banner.png
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+export XDG_RUNTIME_DIR=$work XDG_CACHE_HOME=$work
+
+status=0
+for format in xrgb8888 xbgr8888 rgb888 rgb565 xrgb1555 pal8; do
+    for dither in none ordered fs; do
+        for crop in "" "-C 100,50,700,500"; do
+            name="$format $dither $crop"
+            ./fbtty -n -X 640x480:$format -d $dither $crop -D "$work/band.ppm" "$image" </dev/null >/dev/null &&
+            ./fbtty -n -X 640x480:$format -d $dither $crop -s test -D "$work/shadow.ppm" "$image" </dev/null >/dev/null ||
+                { echo "FAIL: $name: fbtty failed"; status=1; continue; }
+            cmp -s "$work/band.ppm" "$work/shadow.ppm" || { echo "FAIL: $name: band and shadow differ"; status=1; }
+        done
+    done
+done
+
+# raw image is copied straight from file, through shadow it's unpacked and packed again
+for format in xrgb8888 rgb888 rgb565 xrgb1555; do
+    ./fbtty -X 640x480:$format -E raw -o "$work/image.raw" "$image" &&
+    ./fbtty -n -X 640x480:$format -D "$work/band.ppm" "$work/image.raw" </dev/null >/dev/null &&
+    ./fbtty -n -X 640x480:$format -s test -D "$work/shadow.ppm" "$work/image.raw" </dev/null >/dev/null &&
+    cmp -s "$work/band.ppm" "$work/shadow.ppm" || { echo "FAIL: raw $format"; status=1; }
+done
+
+# QOI is lossless, converted image must draw the same as its source
+./fbtty -E qoi -o "$work/image.qoi" "$image" &&
+./fbtty -n -X 640x480 -D "$work/png.ppm" "$image" </dev/null >/dev/null &&
+./fbtty -n -X 640x480 -D "$work/qoi.ppm" "$work/image.qoi" </dev/null >/dev/null &&
+cmp -s "$work/png.ppm" "$work/qoi.ppm" || { echo "FAIL: QOI round trip"; status=1; }
+# truncated QOI must be refused, not drawn from memory past its end
+head -c 5000 "$work/image.qoi" > "$work/short.qoi"
+if ./fbtty -n -X 640x480 "$work/short.qoi" </dev/null >/dev/null 2>&1; then
+    echo "FAIL: truncated QOI was accepted"; status=1
+fi
+
+./fbtty -n -X 640x480 -D "$work/file.ppm" "$image" </dev/null >/dev/null &&
+cat "$image" | ./fbtty -n -X 640x480 -D "$work/pipe.ppm" /dev/stdin >/dev/null &&
+cmp -s "$work/file.ppm" "$work/pipe.ppm" || { echo "FAIL: image from pipe"; status=1; }
+exit $status
@@ -0,0 +1,101 @@
+/* fs_dither_check - Threaded Floyd-Steinberg must match serial one exactly
+ *
+ * Run by `make check`. Dithers random and gradient images of widths around
+ * chunk and lag boundaries into rgb565, xrgb1555 and palette pixels with
+ * fs_dither_rows on several thread counts and compares every byte with
+ * fs_dither_serial. Prints failing cases, exits with 1 if there are any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FB_BLIT_IMPLEMENTATION
+#include "../libs/fb_blit.h"
+#define FB_PALETTE_IMPLEMENTATION
+#include "../libs/fb_palette.h"
+#define FB_DITHER_IMPLEMENTATION
+#include "../libs/fb_dither.h"
+
+static const int check_widths[] = {1, 2, 3, 5, 63, 64, 65, 66, 129, 200, 1023};
+static const int check_heights[] = {1, 2, 7, 40};
+static const int check_threads[] = {2, 3, 4, 7, 16};
+
+// Fill RGB image with noise (*noisy*) or smooth gradient, which diffuses
+// small errors far
+static void fill_image(unsigned char* data, int width, int height, int noisy, unsigned int* seed) {
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 3; c++) {
+                unsigned char* v = &data[((size_t) y * width + x) * 3 + c];
+                if (noisy) {
+                    *seed = *seed * 1103515245 + 12345;
+                    *v = *seed >> 16;
+                } else {
+                    *v = (x * 255 / width + y * (c + 1)) & 0xFF;
+                }
+            }
+}
+
+int main(void) {
+    static const fb_format truecolor[] = {
+        {2, {11, 5, 0}, {5, 6, 5}, NULL, NULL},     // rgb565
+        {2, {10, 5, 0}, {5, 5, 5}, NULL, NULL},     // xrgb1555
+    };
+    static fb_palette palette;
+    fb_palette_standard(&palette);
+    fb_palette_build_lut(&palette);
+    fb_format pal8 = {1, {0, 0, 0}, {8, 8, 8}, &palette.colors[0][0], palette.lut};
+
+    struct {
+        const char* name;
+        const fb_format* format;
+        fs_quantize_fn quantize;
+    } targets[] = {
+        {"rgb565", &truecolor[0], fs_quantize_truecolor},
+        {"xrgb1555", &truecolor[1], fs_quantize_truecolor},
+        {"pal8", &pal8, fs_quantize_palette},
+    };
+
+    int failed = 0, cases = 0;
+    unsigned int seed = 1;
+    for (size_t w = 0; w < sizeof(check_widths) / sizeof(*check_widths); w++)
+    for (size_t h = 0; h < sizeof(check_heights) / sizeof(*check_heights); h++)
+    for (int noisy = 0; noisy < 2; noisy++) {
+        int width = check_widths[w], height = check_heights[h];
+        unsigned char* data = malloc((size_t) width * height * 3);
+        unsigned char* expected = malloc((size_t) width * height * 4);
+        unsigned char* got = malloc((size_t) width * height * 4);
+        if (data == NULL || expected == NULL || got == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        fill_image(data, width, height, noisy, &seed);
+
+        for (size_t t = 0; t < sizeof(targets) / sizeof(*targets); t++) {
+            int bpp = targets[t].format->bytes_per_pixel;
+            size_t out_size = (size_t) width * height * bpp;
+            if (fs_dither_serial(data, width * 3, width, height, expected, width * bpp, bpp,
+                                 targets[t].quantize, targets[t].format) == -1) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            for (size_t n = 0; n < sizeof(check_threads) / sizeof(*check_threads); n++) {
+                memset(got, 0xAA, out_size);
+                int ret = fs_dither_rows(data, width * 3, width, height, got, width * bpp, bpp,
+                                         targets[t].quantize, targets[t].format, check_threads[n]);
+                cases++;
+                if (ret != 0 || memcmp(expected, got, out_size) != 0) {
+                    printf("FAIL: %s %dx%d %s, %d threads\n", targets[t].name, width, height,
+                           noisy ? "noise" : "gradient", check_threads[n]);
+                    failed++;
+                }
+            }
+        }
+        free(data);
+        free(expected);
+        free(got);
+    }
+    printf("%d of %d cases match serial dithering\n", cases - failed, cases);
+    return failed > 0;
+}